@@ -0,0 +1,119 @@
+#pragma once
+
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+
+#include "base.h"
+
+namespace toml
+{
+TOML_NAMESPACE_BEGIN
+
+/**
+ * A monotonic memory arena backing the nodes of one parsed document.
+ *
+ * Nodes allocated from an arena never return memory individually: their
+ * deallocation is a no-op and all blocks are released together once the
+ * last node referring to the arena is destroyed. While a parser is filling
+ * the arena it is the only user and allocates without locking; after the
+ * document has been handed out, allocations (e.g. inserting into a parsed
+ * table) are serialized.
+ */
+class arena final : public std::pmr::memory_resource
+{
+public:
+    explicit arena(size_t initial_size = 64 * 1024)
+        : buffer_(initial_size) {}
+
+    arena(const arena &) = delete;
+    arena &operator=(const arena &) = delete;
+
+    /**
+     * Marks the arena as reachable from more than one thread.
+     */
+    void share() noexcept
+    {
+        shared_ = true;
+    }
+
+private:
+    std::pmr::monotonic_buffer_resource buffer_;
+    std::mutex mutex_;
+    bool shared_{false};
+
+    void *do_allocate(size_t bytes, size_t alignment) override
+    {
+        if (shared_)
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            return buffer_.allocate(bytes, alignment);
+        }
+        return buffer_.allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void *, size_t, size_t) override
+    {
+        // released with the whole arena
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        return this == &other;
+    }
+};
+
+/**
+ * Allocator for std::allocate_shared that places nodes and their control
+ * blocks in an arena. Every allocation keeps the arena alive, so nodes
+ * detached from their document stay valid.
+ */
+template <class T>
+class arena_allocator
+{
+    template <class U>
+    friend class arena_allocator;
+
+public:
+    using value_type = T;
+
+    explicit arena_allocator(std::shared_ptr<arena> a) noexcept
+        : arena_(std::move(a)) {}
+
+    template <class U>
+    arena_allocator(const arena_allocator<U> &other) noexcept
+        : arena_(other.arena_) {}
+
+    T *allocate(size_t n)
+    {
+        return static_cast<T *>(arena_->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *p, size_t n) noexcept
+    {
+        arena_->deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    std::pmr::memory_resource *resource() const noexcept
+    {
+        return arena_.get();
+    }
+
+    template <class U>
+    bool operator==(const arena_allocator<U> &other) const noexcept
+    {
+        return arena_ == other.arena_;
+    }
+
+    template <class U>
+    bool operator!=(const arena_allocator<U> &other) const noexcept
+    {
+        return arena_ != other.arena_;
+    }
+
+private:
+    std::shared_ptr<arena> arena_;
+};
+
+TOML_NAMESPACE_END
+} // namespace toml
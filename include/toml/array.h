@@ -1,20 +1,41 @@
 #pragma once
 
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <variant>
 #include <vector>
 
 #include "base.h"
 #include "node.h"
+#include "value.h"
 
 namespace toml
 {
 TOML_NAMESPACE_BEGIN
 
+/**
+ * An array of nodes.
+ *
+ * Arrays whose elements all have one scalar type (integer, float, boolean
+ * or string) can instead be stored packed, as one std::vector of that
+ * type; the parser packs them. collect(), map_collect(), as_span() and
+ * size() read packed elements directly. The node interface (get(),
+ * iteration, at()) still works: the first read through it builds the
+ * element nodes once, and they are kept in step with push_packed().
+ * Members that change the element set (push_back(), insert(), erase() and
+ * the like) unpack the array for good; call unpack() before modifying
+ * elements in place. Elements are replaced through insert() and erase();
+ * get() and the iterators do not allow it.
+ */
 class array final : public node
 {
     struct make_shared_enabler
     {
     };
     friend std::shared_ptr<array> make_array();
+    template <class Alloc>
+    friend std::shared_ptr<array> allocate_array(const Alloc &alloc);
     friend class node_view;
 
 public:
@@ -22,15 +43,27 @@ public:
     using size_type = size_t;
     using difference_type = ptrdiff_t;
 
-    using iterator = std::vector<std::shared_ptr<node>>::iterator;
+    // read-only, so that the element summary cannot go stale
+    using iterator = std::vector<std::shared_ptr<node>>::const_iterator;
     using const_iterator = std::vector<std::shared_ptr<node>>::const_iterator;
 
+    /**
+     * Whether elements of type T can be stored packed.
+     */
+    template <typename T>
+    static constexpr bool is_packable = is_one_of_v<T, int64_t, double, bool, std::string>;
+
     array(const make_shared_enabler &) noexcept
         : node(base_type::Array) {}
 
     std::shared_ptr<node> clone() const override
     {
         auto result = make_array();
+        if (is_packed())
+        {
+            result->packed_ = packed_;
+            return result;
+        }
         result->reserve(nodes_.size());
         for (const auto &ptr : nodes_)
         {
@@ -44,109 +77,244 @@ public:
         return is_table_array() ? base_type::TableArray : node::type();
     }
 
-    iterator begin() noexcept
-    {
-        return nodes_.begin();
-    }
-
     const_iterator begin() const noexcept
     {
-        return nodes_.begin();
+        return get().begin();
     }
 
     const_iterator cbegin() const noexcept
     {
-        return nodes_.cbegin();
-    }
-
-    iterator end() noexcept
-    {
-        return nodes_.end();
+        return get().cbegin();
     }
 
     const_iterator end() const noexcept
     {
-        return nodes_.end();
+        return get().end();
     }
 
     const_iterator cend() const noexcept
     {
-        return nodes_.cend();
+        return get().cend();
     }
 
     bool empty() const noexcept
     {
-        return nodes_.empty();
+        return size() == 0;
     }
 
     size_t size() const noexcept
     {
+        if (is_packed())
+        {
+            return std::visit(packed_size{}, packed_);
+        }
         return nodes_.size();
     }
 
     void reserve(size_type n)
     {
+        unpack();
         nodes_.reserve(n);
     }
 
     template <typename T>
     bool is_homogeneous() const noexcept
     {
-        if (nodes_.empty())
+        return element_type() == value_type_traits<T>::value;
+    }
+
+    bool is_table_array() const noexcept override
+    {
+        return element_type() == base_type::Table;
+    }
+
+    /**
+     * The type all elements share, base_type::Array for arrays of any kind;
+     * base_type::None if the array is empty or mixed.
+     */
+    base_type element_type() const noexcept
+    {
+        if (is_packed())
+        {
+            return packed_type();
+        }
+        return static_cast<base_type>(summary() & summary_type_mask);
+    }
+
+    /**
+     * Whether any element is an inline table.
+     */
+    bool has_inline_table() const noexcept
+    {
+        return !is_packed() && (summary() & summary_inline_table);
+    }
+
+    /**
+     * Whether the elements are stored packed.
+     */
+    bool is_packed() const noexcept
+    {
+        return packed_.index() != 0;
+    }
+
+    /**
+     * The type of the packed elements, base_type::None if not packed.
+     */
+    base_type packed_type() const noexcept
+    {
+        switch (packed_.index())
         {
-            return false;
+        case 1:
+            return base_type::Integer;
+        case 2:
+            return base_type::Float;
+        case 3:
+            return base_type::Boolean;
+        case 4:
+            return base_type::String;
+        default:
+            return base_type::None;
         }
+    }
 
-        for (const auto &n : nodes_)
+    /**
+     * The packed elements as contiguous storage, without copying. Empty
+     * unless the array is packed as T. Booleans are packed as bits, so
+     * they are read with collect<bool>() instead.
+     */
+    template <typename T>
+    span<const T> as_span() const noexcept
+    {
+        static_assert(is_one_of_v<T, int64_t, double, std::string>,
+                      "as_span supports arrays of int64_t, double and std::string");
+
+        if (const auto *elements = std::get_if<std::vector<T>>(&packed_))
         {
-            if (n->type() != value_type_traits<T>::value)
-            {
-                return false;
-            }
+            return {elements->data(), elements->size()};
         }
-        return true;
+        return {};
     }
 
-    bool is_table_array() const noexcept override
+    /**
+     * Calls f with the packed elements, a std::vector of int64_t, double,
+     * bool or std::string. Returns false, without calling f, if the array
+     * is not packed.
+     */
+    template <class F>
+    bool visit_packed(F &&f) const
     {
-        return is_homogeneous<toml::table>();
+        return std::visit(
+            [&](const auto &elements)
+            {
+                if constexpr (std::is_same_v<std::decay_t<decltype(elements)>, std::monostate>)
+                {
+                    return false;
+                }
+                else
+                {
+                    f(elements);
+                    return true;
+                }
+            },
+            packed_);
     }
 
-    std::vector<std::shared_ptr<node>> &get() noexcept
+    /**
+     * Appends val to a packed array of T, or starts one if the array is
+     * empty. Returns false, leaving val untouched, if the array holds
+     * anything else.
+     */
+    template <typename T>
+    std::enable_if_t<is_packable<std::decay_t<T>>, bool> push_packed(T &&val)
     {
-        return nodes_;
+        using U = std::decay_t<T>;
+        if (!is_packed() && nodes_.empty())
+        {
+            packed_.template emplace<std::vector<U>>();
+        }
+        if (auto *elements = std::get_if<std::vector<U>>(&packed_))
+        {
+            elements->push_back(std::forward<T>(val));
+            if (mirrored_)
+            {
+                // keep the element nodes of an array already read in step
+                nodes_.push_back(make_value(U(elements->back())));
+            }
+            return true;
+        }
+        return false;
     }
 
+    /**
+     * The element nodes. For a packed array they are built on first use;
+     * see the class comment before modifying them in place.
+     */
     const std::vector<std::shared_ptr<node>> &get() const noexcept
     {
+        mirror();
         return nodes_;
     }
 
     std::shared_ptr<node> at(size_t idx)
     {
-        return nodes_.at(idx);
+        return get().at(idx);
     }
 
     std::shared_ptr<const node> at(size_t idx) const
     {
-        return nodes_.at(idx);
+        return get().at(idx);
     }
 
     std::shared_ptr<node> front()
     {
-        return nodes_.front();
+        return get().front();
     }
 
     std::shared_ptr<node> back()
     {
-        return nodes_.back();
+        return get().back();
+    }
+
+    /**
+     * Switches a packed array to node storage, after which its elements
+     * can be modified in place.
+     */
+    void unpack()
+    {
+        if (is_packed())
+        {
+            mirror();
+            summary_.store(summary_valid | static_cast<uint16_t>(packed_type()),
+                           std::memory_order_relaxed);
+            packed_ = std::monostate{};
+        }
     }
 
     template <typename T, typename U = typename value_type_traits<T>::type>
     std::vector<U> collect() const
     {
         std::vector<U> result;
-        for (const auto &n : nodes_)
+        if constexpr (is_value_promotable<std::decay_t<T>>)
+        {
+            if (is_packed())
+            {
+                result.reserve(size());
+                visit_packed(
+                    [&](const auto &elements)
+                    {
+                        for (const auto &e : elements)
+                        {
+                            if (auto val = detail::promote_value<U>(detail::scalar_source{e}))
+                            {
+                                result.emplace_back(std::move(*val));
+                            }
+                        }
+                    });
+                return result;
+            }
+        }
+
+        for (const auto &n : get())
         {
             if constexpr (std::is_same_v<T, node_view>)
             {
@@ -175,7 +343,28 @@ public:
     std::vector<U> map_collect(F &&f) const
     {
         std::vector<U> result;
-        for (const auto &n : nodes_)
+        if constexpr (is_value_promotable<std::decay_t<T>>)
+        {
+            using V = typename value_type_traits<std::decay_t<T>>::type;
+            if (is_packed())
+            {
+                result.reserve(size());
+                visit_packed(
+                    [&](const auto &elements)
+                    {
+                        for (const auto &e : elements)
+                        {
+                            if (auto val = detail::promote_value<V>(detail::scalar_source{e}))
+                            {
+                                result.emplace_back(f(*val));
+                            }
+                        }
+                    });
+                return result;
+            }
+        }
+
+        for (const auto &n : get())
         {
             if (const auto val = n->template map<T>(f))
             {
@@ -187,48 +376,152 @@ public:
 
     void push_back(std::shared_ptr<node> &&n)
     {
+        unpack();
         nodes_.emplace_back(n);
+        add_to_summary(*nodes_.back());
     }
 
     template <typename T>
     std::enable_if_t<toml::is_value_promotable<T>> emplace_back(T &&val)
     {
+        unpack();
         nodes_.emplace_back(make_value(std::forward<T>(val)));
+        add_to_summary(*nodes_.back());
     }
 
     template <typename T>
     std::enable_if_t<std::is_convertible_v<T, std::shared_ptr<node>>> emplace_back(T &&val)
     {
+        unpack();
         nodes_.emplace_back(std::forward<T>(val));
+        add_to_summary(*nodes_.back());
     }
 
     void pop_back()
     {
+        unpack();
         nodes_.pop_back();
+        summary_.store(0, std::memory_order_relaxed);
     }
 
     void clear() noexcept
     {
+        packed_ = std::monostate{};
         nodes_.clear();
+        summary_.store(summary_valid, std::memory_order_relaxed);
     }
 
-    iterator insert(iterator position, std::shared_ptr<node> &&value)
+    iterator insert(const_iterator position, std::shared_ptr<node> &&value)
     {
+        unpack();
+        add_to_summary(*value);
         return nodes_.insert(position, value);
     }
 
     iterator erase(const_iterator pos)
     {
+        unpack();
+        summary_.store(0, std::memory_order_relaxed);
         return nodes_.erase(pos);
     }
 
     iterator erase(const_iterator first, const_iterator last)
     {
+        unpack();
+        summary_.store(0, std::memory_order_relaxed);
         return nodes_.erase(first, last);
     }
 
 private:
-    std::vector<std::shared_ptr<node>> nodes_;
+    using packed_storage = std::variant<std::monostate, std::vector<int64_t>, std::vector<double>,
+                                        std::vector<bool>, std::vector<std::string>>;
+
+    struct packed_size
+    {
+        size_t operator()(std::monostate) const noexcept
+        {
+            return 0;
+        }
+
+        template <class Elements>
+        size_t operator()(const Elements &elements) const noexcept
+        {
+            return elements.size();
+        }
+    };
+
+    /*
+     * The summary of the element types of an unpacked array: the common
+     * type in the low bits (None while empty or once mixed) and flags.
+     * Appending keeps it current; removing elements clears it, and the
+     * next query recomputes it. The element vector is only handed out
+     * const, so no element is replaced behind its back.
+     */
+    enum : uint16_t
+    {
+        summary_type_mask = 0xff,
+        summary_valid = 1 << 8,
+        summary_mixed = 1 << 9,
+        summary_inline_table = 1 << 10,
+    };
+
+    // once mirrored_ is set, nodes_ mirrors packed_ whenever the array is packed
+    mutable std::vector<std::shared_ptr<node>> nodes_;
+    packed_storage packed_;
+    mutable std::once_flag mirror_once_;
+    mutable bool mirrored_{false};
+    mutable std::atomic<uint16_t> summary_{summary_valid};
+
+    static inline uint16_t add_to_summary(uint16_t summary, const node &n) noexcept; // implemented in table.h
+
+    void add_to_summary(const node &n) noexcept
+    {
+        auto summary = summary_.load(std::memory_order_relaxed);
+        if (summary & summary_valid)
+        {
+            summary_.store(add_to_summary(summary, n), std::memory_order_relaxed);
+        }
+    }
+
+    uint16_t summary() const noexcept
+    {
+        auto summary = summary_.load(std::memory_order_relaxed);
+        if (!(summary & summary_valid))
+        {
+            // concurrent readers all compute and store the same value
+            summary = summary_valid;
+            for (const auto &n : nodes_)
+            {
+                summary = add_to_summary(summary, *n);
+            }
+            summary_.store(summary, std::memory_order_relaxed);
+        }
+        return summary;
+    }
+
+    /**
+     * Builds the element nodes of a packed array on first use. Concurrent
+     * readers of the same array wait for the first one; other arrays are
+     * not affected.
+     */
+    void mirror() const noexcept
+    {
+        if (is_packed())
+        {
+            std::call_once(mirror_once_, [this]()
+                           {
+                               visit_packed(
+                                   [&](const auto &elements)
+                                   {
+                                       nodes_.reserve(elements.size());
+                                       for (const auto &e : elements)
+                                       {
+                                           nodes_.push_back(make_value(static_cast<std::decay_t<decltype(e)>>(e)));
+                                       }
+                                   });
+                               mirrored_ = true; });
+        }
+    }
 
     array() noexcept
         : node(base_type::Array) {}
@@ -236,16 +529,17 @@ private:
     template <class InputIterator>
     array(InputIterator begin, InputIterator end) noexcept
         : node(base_type::Array),
-          nodes_{begin, end} {}
+          nodes_{begin, end},
+          summary_{0} {}
 
     array(const array &obj) = delete;
     array &operator=(const array &obj) = delete;
 
     std::shared_ptr<node> operator[](size_t index)
     {
-        if (index < nodes_.size())
+        if (index < size())
         {
-            return nodes_[index];
+            return get()[index];
         }
         else
         {
@@ -301,5 +595,11 @@ std::shared_ptr<array> make_array()
     return std::make_shared<array>(array::make_shared_enabler{});
 }
 
+template <class Alloc>
+std::shared_ptr<array> allocate_array(const Alloc &alloc)
+{
+    return std::allocate_shared<array>(alloc, array::make_shared_enabler{});
+}
+
 TOML_NAMESPACE_END
 } // namespace toml
\ No newline at end of file
@@ -1,7 +1,10 @@
 #pragma once
 
+#include <cstddef>
+#include <iterator>
 #include <map>
 #include <memory>
+#include <memory_resource>
 #include <optional>
 #include <string>
 #include <string_view>
@@ -11,6 +14,72 @@ namespace toml
 {
 TOML_NAMESPACE_BEGIN
 
+/**
+ * A view of a contiguous sequence of T, like C++20's std::span with a
+ * dynamic extent.
+ */
+template <typename T>
+class span
+{
+public:
+    using element_type = T;
+    using value_type = std::remove_cv_t<T>;
+    using size_type = std::size_t;
+    using iterator = T *;
+
+    constexpr span() noexcept = default;
+
+    constexpr span(T *data, size_type size) noexcept
+        : data_(data),
+          size_(size) {}
+
+    template <std::size_t N>
+    constexpr span(T (&elements)[N]) noexcept
+        : data_(elements),
+          size_(N) {}
+
+    template <class Container,
+              typename = std::enable_if_t<
+                  std::is_convertible_v<decltype(std::data(std::declval<Container &>())), T *>>>
+    constexpr span(Container &container) noexcept(noexcept(std::data(container)))
+        : data_(std::data(container)),
+          size_(std::size(container)) {}
+
+    constexpr T *data() const noexcept
+    {
+        return data_;
+    }
+
+    constexpr size_type size() const noexcept
+    {
+        return size_;
+    }
+
+    constexpr bool empty() const noexcept
+    {
+        return size_ == 0;
+    }
+
+    constexpr T &operator[](size_type index) const noexcept
+    {
+        return data_[index];
+    }
+
+    constexpr iterator begin() const noexcept
+    {
+        return data_;
+    }
+
+    constexpr iterator end() const noexcept
+    {
+        return data_ + size_;
+    }
+
+private:
+    T *data_{nullptr};
+    size_type size_{0};
+};
+
 template <typename T, typename... U>
 using is_one_of = std::disjunction<std::is_same<T, U>...>;
 
@@ -177,7 +246,39 @@ inline constexpr bool is_char = std::is_same_v<const char (&)[1], const char *>;
 template <class U>
 inline std::shared_ptr<value<typename value_type_traits<U>::base_type>> make_value(U &&val);
 inline std::shared_ptr<array> make_array();
-inline std::shared_ptr<table> make_table(bool is_inline = false);
+inline std::shared_ptr<table> make_table(bool is_inline = false,
+                                         table_storage storage = table_storage::ordered);
+
+template <class Alloc, class U>
+inline std::shared_ptr<value<typename value_type_traits<U>::base_type>> allocate_value(const Alloc &alloc, U &&val);
+template <class Alloc>
+inline std::shared_ptr<array> allocate_array(const Alloc &alloc);
+template <class Alloc>
+inline std::shared_ptr<table> allocate_table(const Alloc &alloc, bool is_inline = false,
+                                             table_storage storage = table_storage::ordered);
+
+namespace detail
+{
+/// The memory resource a table allocated with Alloc should use for its
+/// entries: Alloc's own if it exposes one (e.g. arena_allocator).
+template <class Alloc, class = void>
+struct allocator_resource
+{
+    static std::pmr::memory_resource *get(const Alloc &) noexcept
+    {
+        return std::pmr::get_default_resource();
+    }
+};
+
+template <class Alloc>
+struct allocator_resource<Alloc, std::void_t<decltype(std::declval<const Alloc &>().resource())>>
+{
+    static std::pmr::memory_resource *get(const Alloc &alloc) noexcept
+    {
+        return alloc.resource();
+    }
+};
+} // namespace detail
 
 TOML_NAMESPACE_END
 } // namespace toml
\ No newline at end of file
@@ -0,0 +1,660 @@
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "base.h"
+#include "node_ref.h"
+#include "node_view.h"
+#include "writer.h"
+
+namespace toml
+{
+TOML_NAMESPACE_BEGIN
+
+/**
+ * A member of a bound struct: its TOML key and the member pointer. The key
+ * may be dotted to reach into sub-tables.
+ */
+template <class Class, class Member>
+struct field_binding
+{
+    std::string_view key;
+    Member Class::*member;
+    bool required;
+};
+
+/**
+ * A field that keeps the value the struct was constructed with when its key
+ * is missing.
+ */
+template <class Class, class Member>
+constexpr field_binding<Class, Member> field(std::string_view key, Member Class::*member) noexcept
+{
+    return {key, member, false};
+}
+
+/**
+ * A field whose key must be present.
+ */
+template <class Class, class Member>
+constexpr field_binding<Class, Member> required(std::string_view key, Member Class::*member) noexcept
+{
+    return {key, member, true};
+}
+
+/**
+ * Binds a struct to TOML tables by listing its fields:
+ *
+ *     struct server
+ *     {
+ *         std::string host;
+ *         int port = 8080;
+ *     };
+ *     TOML_BIND(server, toml::required("host", &server::host),
+ *                       toml::field("port", &server::port))
+ *
+ * Use it in the namespace of the struct, where it is found by argument
+ * dependent lookup. Defaults are the struct's own member initializers.
+ */
+#define TOML_BIND(type, ...)                                   \
+    [[maybe_unused]] constexpr auto toml_fields(const type *) \
+    {                                                          \
+        return std::make_tuple(__VA_ARGS__);                   \
+    }
+
+/**
+ * Thrown by decode() when a document does not fit the bound type.
+ */
+class decode_error : public std::runtime_error
+{
+public:
+    decode_error(const std::string &path, const std::string &reason)
+        : std::runtime_error{path.empty() ? reason : path + ": " + reason},
+          path_(path) {}
+
+    /**
+     * Where the mismatch is, such as `servers[2].port`.
+     */
+    const std::string &path() const noexcept
+    {
+        return path_;
+    }
+
+private:
+    std::string path_;
+};
+
+namespace detail
+{
+template <class T, class = void>
+struct is_bound : std::false_type
+{
+};
+
+template <class T>
+struct is_bound<T, std::void_t<decltype(toml_fields(static_cast<const T *>(nullptr)))>>
+    : std::true_type
+{
+};
+
+template <class T>
+struct is_optional : std::false_type
+{
+};
+
+template <class T>
+struct is_optional<std::optional<T>> : std::true_type
+{
+};
+
+template <class T>
+struct is_vector : std::false_type
+{
+};
+
+template <class T, class Alloc>
+struct is_vector<std::vector<T, Alloc>> : std::true_type
+{
+};
+
+template <class T>
+struct is_string_map : std::false_type
+{
+};
+
+template <class T, class Compare, class Alloc>
+struct is_string_map<std::map<std::string, T, Compare, Alloc>> : std::true_type
+{
+};
+
+template <class T, class Hash, class Equal, class Alloc>
+struct is_string_map<std::unordered_map<std::string, T, Hash, Equal, Alloc>> : std::true_type
+{
+};
+
+template <class T>
+struct is_unordered_string_map : std::false_type
+{
+};
+
+template <class T, class Hash, class Equal, class Alloc>
+struct is_unordered_string_map<std::unordered_map<std::string, T, Hash, Equal, Alloc>> : std::true_type
+{
+};
+
+template <class T>
+inline constexpr bool is_table_like = is_bound<T>::value || is_string_map<T>::value;
+
+template <class T>
+inline constexpr bool is_decodable_integer = std::is_integral_v<T> && !std::is_same_v<T, bool>;
+
+template <class T>
+inline constexpr bool always_false = false;
+
+/**
+ * The position being decoded, kept on the stack and only turned into a
+ * string for an error message.
+ */
+struct decode_path
+{
+    const decode_path *parent{nullptr};
+    std::string_view key;
+    size_t index{0};
+    bool is_index{false};
+
+    std::string str() const
+    {
+        auto result = parent ? parent->str() : std::string{};
+        if (is_index)
+        {
+            result += '[' + std::to_string(index) + ']';
+        }
+        else if (!key.empty())
+        {
+            if (!result.empty())
+                result += '.';
+            result += key;
+        }
+        return result;
+    }
+};
+
+[[noreturn]] inline void throw_decode_error(const decode_path &path, const std::string &reason)
+{
+    throw decode_error(path.str(), reason);
+}
+
+inline const char *type_description(base_type type) noexcept
+{
+    switch (type)
+    {
+    case base_type::String:
+        return "a string";
+    case base_type::Integer:
+        return "an integer";
+    case base_type::Float:
+        return "a float";
+    case base_type::Boolean:
+        return "a boolean";
+    case base_type::LocalDate:
+        return "a date";
+    case base_type::LocalTime:
+        return "a time";
+    case base_type::LocalDateTime:
+        return "a date-time";
+    case base_type::OffsetDateTime:
+        return "an offset date-time";
+    default:
+        return "a value";
+    }
+}
+
+template <class T>
+bool fits(int64_t value) noexcept
+{
+    if constexpr (std::is_unsigned_v<T>)
+    {
+        return value >= 0 && static_cast<uint64_t>(value) <= std::numeric_limits<T>::max();
+    }
+    else
+    {
+        return value >= std::numeric_limits<T>::min() && value <= std::numeric_limits<T>::max();
+    }
+}
+
+template <class T>
+void decode_value(node_ref ref, T &out, const decode_path &path);
+
+template <class Class, class Member>
+void decode_field(node_ref tbl, Class &obj, const field_binding<Class, Member> &f,
+                  const decode_path &path)
+{
+    decode_path child_path{&path, f.key};
+    if (auto child = tbl[f.key])
+    {
+        decode_value(child, obj.*(f.member), child_path);
+    }
+    else if (f.required)
+    {
+        throw_decode_error(child_path, "missing required key");
+    }
+}
+
+template <class T>
+void decode_value(node_ref ref, T &out, const decode_path &path)
+{
+    if constexpr (std::is_same_v<T, node_view>)
+    {
+        out = ref.view();
+    }
+    else if constexpr (is_bound<T>::value)
+    {
+        if (!ref.is_table())
+            throw_decode_error(path, "expected a table");
+
+        std::apply([&](const auto &...fields)
+                   { (decode_field(ref, out, fields, path), ...); },
+                   toml_fields(static_cast<const T *>(nullptr)));
+    }
+    else if constexpr (is_optional<T>::value)
+    {
+        decode_value(ref, out.emplace(), path);
+    }
+    else if constexpr (is_vector<T>::value)
+    {
+        using U = typename T::value_type;
+        if (!ref.is_array())
+            throw_decode_error(path, "expected an array");
+
+        out.clear();
+        if constexpr (is_one_of_v<U, int64_t, double, std::string>)
+        {
+            // packed arrays of exactly this type are copied in one go
+            if (auto elements = ref.as_span<U>(); !elements.empty())
+            {
+                out.assign(elements.begin(), elements.end());
+                return;
+            }
+        }
+        ref.for_each_element(
+            [&](node_ref element)
+            {
+                U value{};
+                decode_value(element, value, decode_path{&path, {}, out.size(), true});
+                out.push_back(std::move(value));
+            });
+    }
+    else if constexpr (is_string_map<T>::value)
+    {
+        if (!ref.is_table())
+            throw_decode_error(path, "expected a table");
+
+        out.clear();
+        ref.for_each_entry(
+            [&](std::string_view key, node_ref element)
+            {
+                typename T::mapped_type value{};
+                decode_value(element, value, decode_path{&path, key});
+                out.insert_or_assign(std::string{key}, std::move(value));
+            });
+    }
+    else if constexpr (is_decodable_integer<T>)
+    {
+        auto value = ref.get<int64_t>();
+        if (!value)
+            throw_decode_error(path, "expected an integer");
+        if (!fits<T>(*value))
+            throw_decode_error(path, "integer " + std::to_string(*value) + " is out of range");
+        out = static_cast<T>(*value);
+    }
+    else if constexpr (is_value_promotable<T> && !std::is_same_v<T, std::string_view>)
+    {
+        auto value = ref.get<T>();
+        if (!value)
+            throw_decode_error(path, std::string{"expected "} +
+                                         type_description(value_type_traits<T>::value));
+        out = std::move(*value);
+    }
+    else
+    {
+        static_assert(always_false<T>, "cannot decode this type: bind it with TOML_BIND");
+    }
+}
+
+/**
+ * Writes bound structs and string-keyed maps through a toml_writer, in the
+ * layout the writer gives a tree: plain values first, then arrays of
+ * tables, then sub-tables. Fields keep their declared order within each
+ * group; map entries are written by key. Empty optionals and node_views
+ * are left out.
+ */
+class struct_encoder
+{
+public:
+    explicit struct_encoder(toml_writer &w) noexcept
+        : w_(w) {}
+
+    template <class T>
+    void write_table(const T &obj, bool in_array)
+    {
+        toml_writer::scope s{w_};
+        w_.write_table_header(in_array);
+
+        const auto each = entries(obj);
+        size_t written = 0;
+        for (int group = 0; group < 3; ++group)
+        {
+            each([&](std::string_view key, const auto &v, bool dotted)
+                 {
+                     using V = std::decay_t<decltype(v)>;
+                     if (group_of(v) != group)
+                         return;
+
+                     if (written++ > 0)
+                     {
+                         w_.endline();
+
+                         if (group == 1)
+                             w_.out_->push_back('\n');
+                     }
+
+                     if (group == 0)
+                     {
+                         for (size_t i = 0; i < w_.path_.size(); ++i)
+                             w_.write_raw(w_.indent_);
+                         write_key(key, dotted);
+                         w_.write_raw(" = ");
+                         write_value(v);
+                         return;
+                     }
+
+                     const auto depth = w_.path_.size();
+                     each_part(key, dotted, [&](std::string_view part)
+                               { w_.path_.push_back(part); });
+                     if constexpr (std::is_same_v<V, node_view>)
+                     {
+                         v.accept(w_, false);
+                     }
+                     else if constexpr (is_vector<V>::value)
+                     {
+                         if constexpr (is_table_like<typename V::value_type>)
+                         {
+                             for (const auto &element : v)
+                                 write_table(element, true);
+                         }
+                     }
+                     else if constexpr (is_table_like<V>)
+                     {
+                         write_table(v, false);
+                     }
+                     w_.path_.resize(depth); });
+        }
+
+        w_.endline();
+        w_.out_->push_back('\n');
+        s.leave();
+    }
+
+private:
+    /**
+     * A function calling f(key, value, dotted) for each entry of obj.
+     */
+    template <class T>
+    static auto entries(const T &obj)
+    {
+        if constexpr (is_bound<T>::value)
+        {
+            return [&obj](auto &&f)
+            {
+                std::apply([&](const auto &...fields)
+                           { (entry(f, fields.key, obj.*(fields.member), true), ...); },
+                           toml_fields(static_cast<const T *>(nullptr)));
+            };
+        }
+        else if constexpr (is_unordered_string_map<T>::value)
+        {
+            std::vector<const typename T::value_type *> sorted;
+            sorted.reserve(obj.size());
+            for (const auto &e : obj)
+            {
+                sorted.push_back(&e);
+            }
+            std::sort(sorted.begin(), sorted.end(), [](const auto *lhs, const auto *rhs)
+                      { return lhs->first < rhs->first; });
+            return [sorted = std::move(sorted)](auto &&f)
+            {
+                for (const auto *e : sorted)
+                    entry(f, e->first, e->second, false);
+            };
+        }
+        else
+        {
+            return [&obj](auto &&f)
+            {
+                for (const auto &[key, v] : obj)
+                    entry(f, key, v, false);
+            };
+        }
+    }
+
+    template <class F, class V>
+    static void entry(F &f, std::string_view key, const V &v, bool dotted)
+    {
+        if constexpr (is_optional<V>::value)
+        {
+            if (v)
+                entry(f, key, *v, dotted);
+        }
+        else if constexpr (std::is_same_v<V, node_view>)
+        {
+            if (v)
+                f(key, v, dotted);
+        }
+        else
+        {
+            f(key, v, dotted);
+        }
+    }
+
+    template <class V>
+    static int group_of(const V &v) noexcept
+    {
+        if constexpr (std::is_same_v<V, node_view>)
+        {
+            return v.is_table() ? 2 : v.is_table_array() ? 1 : 0;
+        }
+        else if constexpr (is_table_like<V>)
+        {
+            return 2;
+        }
+        else if constexpr (is_vector<V>::value)
+        {
+            if constexpr (is_table_like<typename V::value_type>)
+                return v.empty() ? 0 : 1;
+            else
+                return 0;
+        }
+        else
+        {
+            return 0;
+        }
+    }
+
+    /**
+     * Calls f for each part of a dotted field key, or once for a map key.
+     */
+    template <class F>
+    static void each_part(std::string_view key, bool dotted, F &&f)
+    {
+        size_t start = 0;
+        for (auto dot = dotted ? key.find('.') : key.npos; dot != key.npos; dot = key.find('.', start))
+        {
+            f(key.substr(start, dot - start));
+            start = dot + 1;
+        }
+        f(key.substr(start));
+    }
+
+    void write_key(std::string_view key, bool dotted)
+    {
+        bool first = true;
+        each_part(key, dotted, [&](std::string_view part)
+                  {
+                      if (!first)
+                          w_.write_raw('.');
+                      first = false;
+                      w_.write_key(part); });
+    }
+
+    /**
+     * Write v where a value is expected: tables become inline tables.
+     */
+    template <class V>
+    void write_value(const V &v)
+    {
+        if constexpr (std::is_same_v<V, node_view>)
+        {
+            v.accept(w_, true);
+        }
+        else if constexpr (std::is_same_v<V, bool>)
+        {
+            w_.write_raw(v ? "true" : "false");
+        }
+        else if constexpr (is_decodable_integer<V>)
+        {
+            if constexpr (std::is_unsigned_v<V> && sizeof(V) >= sizeof(int64_t))
+            {
+                if (v > static_cast<V>(std::numeric_limits<int64_t>::max()))
+                    throw std::out_of_range("toml::encode: integer " + std::to_string(v) + " is out of range");
+            }
+            w_.write_raw(static_cast<int64_t>(v));
+        }
+        else if constexpr (std::is_floating_point_v<V>)
+        {
+            w_.write_raw(static_cast<double>(v));
+        }
+        else if constexpr (std::is_convertible_v<const V &, std::string_view>)
+        {
+            w_.write_quoted(v);
+        }
+        else if constexpr (is_one_of_v<V, local_date, local_time, local_date_time, offset_date_time>)
+        {
+            w_.write_raw(v);
+        }
+        else if constexpr (is_vector<V>::value)
+        {
+            using U = typename V::value_type;
+            w_.write_raw('[');
+            bool first = true;
+            for (auto &&element : v)
+            {
+                const U &e = element;
+                if constexpr (is_optional<U>::value)
+                {
+                    if (!e)
+                        continue;
+                }
+                if (!first)
+                    w_.write_raw(", ");
+                first = false;
+                if constexpr (is_optional<U>::value)
+                    write_value(*e);
+                else
+                    write_value(e);
+            }
+            w_.write_raw(']');
+        }
+        else if constexpr (is_table_like<V>)
+        {
+            w_.write_raw('{');
+            bool first = true;
+            entries(v)([&](std::string_view key, const auto &e, bool dotted)
+                       {
+                           if (!first)
+                               w_.write_raw(", ");
+                           first = false;
+                           write_key(key, dotted);
+                           w_.write_raw(" = ");
+                           write_value(e); });
+            w_.write_raw('}');
+        }
+        else
+        {
+            static_assert(always_false<V>, "cannot encode this type: bind it with TOML_BIND");
+        }
+    }
+
+    toml_writer &w_;
+};
+} // namespace detail
+
+/**
+ * Fills out from the value at ref. Bound structs are decoded field by
+ * field, with one lookup per field in their table; std::optional,
+ * std::vector, std::map and std::unordered_map with std::string keys, and
+ * any TOML value type can be members. Keys of the document that are not
+ * bound are ignored.
+ *
+ * @throw decode_error if a value has the wrong type or is out of range,
+ *        or a required key is missing
+ */
+template <class T>
+void decode(node_ref ref, T &out)
+{
+    detail::decode_value(ref, out, detail::decode_path{});
+}
+
+template <class T>
+void decode(const node_view &view, T &out)
+{
+    decode(view.ref(), out);
+}
+
+/**
+ * Decodes a default-constructed T, see decode(node_ref, T &).
+ */
+template <class T>
+T decode(node_ref ref)
+{
+    T result{};
+    decode(ref, result);
+    return result;
+}
+
+template <class T>
+T decode(const node_view &view)
+{
+    return decode<T>(view.ref());
+}
+
+template <class T>
+inline void toml_writer::encode(const T &obj)
+{
+    static_assert(detail::is_table_like<T>,
+                  "only structs bound with TOML_BIND and maps with std::string keys can be encoded");
+    detail::struct_encoder{*this}.write_table(obj, false);
+}
+
+/**
+ * Writes a bound struct as a TOML document, see toml_writer::encode().
+ * Fields appear in the order they are bound.
+ */
+template <class T>
+std::string encode(const T &obj)
+{
+    std::string out;
+    toml_writer{out}.encode(obj);
+    return out;
+}
+
+TOML_NAMESPACE_END
+} // namespace toml
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <system_error>
+
+#include "base.h"
+#include "document.h"
+#include "mapped_file.h"
+#include "parser.h"
+
+namespace toml
+{
+TOML_NAMESPACE_BEGIN
+
+namespace detail
+{
+inline uint64_t rotl64(uint64_t v, int bits) noexcept
+{
+    return (v << bits) | (v >> (64 - bits));
+}
+
+/**
+ * A 64-bit hash of a byte range that does not change between runs or
+ * builds, so it can be stored. It consumes 32 bytes per round in four
+ * independent lanes, using the round and avalanche steps of xxHash64
+ * (though not its exact output), to keep up with reading the file.
+ */
+inline uint64_t hash_bytes(std::string_view data) noexcept
+{
+    constexpr uint64_t p1 = 0x9E3779B185EBCA87ull;
+    constexpr uint64_t p2 = 0xC2B2AE3D27D4EB4Full;
+    constexpr uint64_t p3 = 0x165667B19E3779F9ull;
+
+    const auto load = [](const char *p)
+    {
+        uint64_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    };
+    const auto round = [](uint64_t acc, uint64_t v)
+    {
+        return rotl64(acc + v * p2, 31) * p1;
+    };
+
+    const char *it = data.data();
+    const char *end = it + data.size();
+    uint64_t lanes[4] = {p1 + p2, p2, 0, 0 - p1};
+    for (; end - it >= 32; it += 32)
+    {
+        for (int i = 0; i < 4; ++i)
+            lanes[i] = round(lanes[i], load(it + 8 * i));
+    }
+
+    uint64_t h = rotl64(lanes[0], 1) + rotl64(lanes[1], 7) + rotl64(lanes[2], 12) + rotl64(lanes[3], 18);
+    for (auto lane : lanes)
+        h = (h ^ round(0, lane)) * p1 + p3;
+    h += data.size();
+
+    for (; end - it >= 8; it += 8)
+        h = rotl64(h ^ round(0, load(it)), 27) * p1 + p3;
+    for (; it != end; ++it)
+        h = rotl64(h ^ (static_cast<uint8_t>(*it) * p3), 11) * p1;
+
+    h ^= h >> 33;
+    h *= p2;
+    h ^= h >> 29;
+    h *= p3;
+    h ^= h >> 32;
+    return h;
+}
+
+/**
+ * The image for a source file: one per absolute path, named after the
+ * file so a cache directory can be inspected by hand.
+ */
+inline std::filesystem::path cached_image_path(const std::filesystem::path &file_path,
+                                               const std::filesystem::path &cache_dir)
+{
+    static constexpr char hex[] = "0123456789abcdef";
+
+    std::error_code ec;
+    auto absolute = std::filesystem::absolute(file_path, ec).lexically_normal();
+    auto hash = hash_bytes((ec ? file_path : absolute).string());
+
+    std::string name = file_path.filename().string() + '.';
+    for (int shift = 60; shift >= 0; shift -= 4)
+        name += hex[(hash >> shift) & 0xf];
+    name += ".tomlc";
+    return cache_dir / name;
+}
+
+/**
+ * Writes an image next to its final name and renames it into place, so
+ * concurrent readers see either the old image or the new one, and
+ * processes still mapping the old one keep a valid mapping. Failures are
+ * ignored: the cache is only an accelerator.
+ */
+inline void store_image(const std::filesystem::path &image_path, const std::string &image)
+{
+    std::error_code ec;
+    std::filesystem::create_directories(image_path.parent_path(), ec);
+
+    auto temp_path = image_path;
+    temp_path += ".tmp" + std::to_string(std::random_device{}());
+    {
+        std::ofstream out{temp_path, std::ios::binary | std::ios::trunc};
+        if (!out.write(image.data(), static_cast<std::streamsize>(image.size())) || !out.flush())
+        {
+            out.close();
+            std::filesystem::remove(temp_path, ec);
+            return;
+        }
+    }
+
+    std::filesystem::rename(temp_path, image_path, ec);
+    if (ec)
+    {
+        std::filesystem::remove(temp_path, ec);
+    }
+}
+} // namespace detail
+
+/**
+ * Parses a file into a compact document through a cache of document images
+ * kept in cache_dir.
+ *
+ * The cached image is used if it was made from a file of the same size,
+ * modification time and content hash; it is then mapped and read in place,
+ * so loading costs one hashing pass over the file instead of a parse.
+ * Otherwise the file is parsed and its image (re)written. An unwritable
+ * cache directory only costs the caching; the result is the same.
+ */
+inline parse_result parse_file_cached(const std::string &file_path, const std::filesystem::path &cache_dir)
+{
+    mapped_file file{file_path};
+
+    if (!file.is_open())
+    {
+        return {parse_error(file_path + " could not be opened for parsing")};
+    }
+
+    source_stamp stamp;
+    stamp.size = file.size();
+    std::error_code ec;
+    auto mtime = std::filesystem::last_write_time(file_path, ec);
+    if (!ec)
+    {
+        stamp.mtime = std::chrono::duration_cast<std::chrono::nanoseconds>(mtime.time_since_epoch()).count();
+    }
+    stamp.hash = detail::hash_bytes(file.view());
+
+    auto image_path = detail::cached_image_path(file_path, cache_dir);
+    if (auto doc = load_document(image_path.string(), stamp))
+    {
+        return {doc->view()};
+    }
+
+    try
+    {
+        parser p{file.view()};
+        auto doc = make_document(*p.parse());
+        detail::store_image(image_path, doc->image(stamp));
+        return {doc->view()};
+    }
+    catch (const parse_error &e)
+    {
+        return {parse_error(file_path + ": " + e.what(), e.source())};
+    }
+}
+
+TOML_NAMESPACE_END
+} // namespace toml
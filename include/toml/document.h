@@ -0,0 +1,600 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include "base.h"
+#include "date_time.h"
+#include "node.h"
+#include "value.h"
+#include "array.h"
+#include "table.h"
+#include "mapped_file.h"
+
+namespace toml
+{
+TOML_NAMESPACE_BEGIN
+
+namespace detail
+{
+enum doc_slot_flags : uint8_t
+{
+    slot_inline_table = 1 << 0,
+};
+
+/**
+ * One entry of a compact document: the key it is stored under (empty for
+ * array elements) and either the value itself or, for strings, tables and
+ * arrays, a range in the document's string pool or slot vector. Everything
+ * is addressed by offset, so slots are plain data.
+ */
+struct doc_slot
+{
+    uint32_t key_offset;
+    uint32_t key_size;
+    base_type type;
+    uint8_t flags;
+    uint8_t reserved[6];
+
+    union
+    {
+        int64_t integer;
+        double floating;
+        bool boolean;
+        struct
+        {
+            uint32_t offset;
+            uint32_t size;
+        } range;
+        alignas(8) unsigned char bytes[16]; // dates and times, copied bytewise
+    } data;
+};
+
+static_assert(sizeof(doc_slot) == 32, "compact document slots should stay 32 bytes");
+static_assert(sizeof(offset_date_time) <= sizeof(doc_slot{}.data.bytes) &&
+                  std::is_trivially_copyable_v<offset_date_time>,
+              "date/time values must fit inline in a slot");
+} // namespace detail
+
+/**
+ * The file a document image was made from, recorded in the image so that a
+ * cache can tell whether the file has changed since. All zero when unused.
+ */
+struct source_stamp
+{
+    uint64_t size{0};
+    int64_t mtime{0}; // nanoseconds since the file clock's epoch
+    uint64_t hash{0};
+
+    friend bool operator==(const source_stamp &lhs, const source_stamp &rhs) noexcept
+    {
+        return lhs.size == rhs.size && lhs.mtime == rhs.mtime && lhs.hash == rhs.hash;
+    }
+
+    friend bool operator!=(const source_stamp &lhs, const source_stamp &rhs) noexcept
+    {
+        return !(lhs == rhs);
+    }
+};
+
+namespace detail
+{
+/**
+ * Start of a document image, followed by the slots and then the string
+ * pool, both exactly as held in memory.
+ */
+struct doc_image_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t slot_size;
+    uint32_t reserved;
+    uint64_t slot_count;
+    uint64_t string_size;
+    source_stamp source;
+};
+
+static_assert(sizeof(doc_image_header) == 64 && sizeof(doc_image_header) % alignof(doc_slot) == 0,
+              "slots of a document image must stay aligned");
+
+inline constexpr char doc_image_magic[8] = {'T', 'O', 'M', 'L', 'D', 'O', 'C', '\0'};
+inline constexpr uint32_t doc_image_version = 1;
+inline constexpr uint32_t doc_image_byte_order = 0x01020304;
+} // namespace detail
+
+/**
+ * A read-only TOML document stored without a node per value.
+ *
+ * All values live in one vector of fixed-size slots: scalars are held
+ * inline in their slot, and the children of each table or array occupy a
+ * contiguous run of slots (table entries sorted by key, so lookups are a
+ * binary search). Keys and string values live in a single string pool, in
+ * which each distinct key is stored once. A document is built from a parsed
+ * table with make_document(), or by parsing with parse_options::compact,
+ * and is read through node_view like the node tree.
+ */
+class document final : public std::enable_shared_from_this<document>
+{
+    struct make_shared_enabler
+    {
+    };
+
+    friend std::shared_ptr<const document> make_document(const table &root);
+    friend std::shared_ptr<const document> load_document(const std::string &file_path);
+    friend std::shared_ptr<const document> load_document(const std::string &file_path,
+                                                         const source_stamp &expected);
+    friend class node_view;
+    friend class node_ref;
+    friend class snapshot;
+
+public:
+    using slot = detail::doc_slot;
+
+    document(const make_shared_enabler &) noexcept {}
+
+    document(const document &) = delete;
+    document &operator=(const document &) = delete;
+
+    /**
+     * A view of the root table.
+     */
+    inline node_view view() const noexcept; // implemented in node_view.h
+
+    /**
+     * Converts the document back into a (mutable, independent) node tree.
+     */
+    std::shared_ptr<table> to_table() const
+    {
+        return std::static_pointer_cast<table>(materialize(root()));
+    }
+
+    /**
+     * Bytes held by the document's slots and string pool, including those
+     * of a mapped image.
+     */
+    size_t memory_usage() const noexcept
+    {
+        return sizeof(document) + slots_.capacity() * sizeof(slot) + strings_.capacity() +
+               image_.size();
+    }
+
+    /**
+     * The document as a binary image that load_document() maps back without
+     * deserializing. Slots and strings are stored as they are in memory, so
+     * an image can only be read by a build with the same layout: the header
+     * records a format version, the byte order and the slot size, and images
+     * that differ are rejected.
+     */
+    std::string image(const source_stamp &source = {}) const
+    {
+        detail::doc_image_header header{};
+        std::memcpy(header.magic, detail::doc_image_magic, sizeof(header.magic));
+        header.version = detail::doc_image_version;
+        header.byte_order = detail::doc_image_byte_order;
+        header.slot_size = sizeof(slot);
+        header.slot_count = slot_data_.size();
+        header.string_size = string_pool_.size();
+        header.source = source;
+
+        std::string result;
+        result.reserve(sizeof(header) + slot_data_.size() * sizeof(slot) + string_pool_.size());
+        result.append(reinterpret_cast<const char *>(&header), sizeof(header));
+        result.append(reinterpret_cast<const char *>(slot_data_.data()), slot_data_.size() * sizeof(slot));
+        result.append(string_pool_);
+        return result;
+    }
+
+private:
+    // built documents own their slots and strings, loaded ones map an image
+    std::vector<slot> slots_;
+    std::string strings_;
+    mapped_file image_;
+    span<const slot> slot_data_;
+    std::string_view string_pool_;
+
+    /**
+     * promote_value() source reading a slot.
+     */
+    struct slot_source
+    {
+        const document &doc;
+        const slot &s;
+
+        template <typename U>
+        std::optional<U> stored() const noexcept
+        {
+            if constexpr (std::is_same_v<U, std::string_view>)
+            {
+                if (s.type == base_type::String)
+                {
+                    return {doc.text(s)};
+                }
+            }
+            else if (s.type == base_type_traits<U>::value)
+            {
+                if constexpr (std::is_same_v<U, int64_t>)
+                {
+                    return {s.data.integer};
+                }
+                else if constexpr (std::is_same_v<U, double>)
+                {
+                    return {s.data.floating};
+                }
+                else if constexpr (std::is_same_v<U, bool>)
+                {
+                    return {s.data.boolean};
+                }
+                else
+                {
+                    U result;
+                    std::memcpy(static_cast<void *>(&result), s.data.bytes, sizeof(U));
+                    return {result};
+                }
+            }
+            return std::nullopt;
+        }
+    };
+
+    template <typename T>
+    std::optional<T> value(const slot &s) const noexcept
+    {
+        return detail::promote_value<T>(slot_source{*this, s});
+    }
+
+    const slot &root() const noexcept
+    {
+        return slot_data_[0];
+    }
+
+    std::string_view key(const slot &s) const noexcept
+    {
+        return {string_pool_.data() + s.key_offset, s.key_size};
+    }
+
+    std::string_view text(const slot &s) const noexcept
+    {
+        return {string_pool_.data() + s.data.range.offset, s.data.range.size};
+    }
+
+    static bool is_container(const slot &s) noexcept
+    {
+        return s.type == base_type::Table || s.type == base_type::Array ||
+               s.type == base_type::TableArray;
+    }
+
+    const slot *children_begin(const slot &s) const noexcept
+    {
+        return slot_data_.data() + s.data.range.offset;
+    }
+
+    const slot *children_end(const slot &s) const noexcept
+    {
+        return slot_data_.data() + s.data.range.offset + s.data.range.size;
+    }
+
+    const slot *find(const slot &tbl, std::string_view name) const noexcept
+    {
+        auto first = children_begin(tbl);
+        auto last = children_end(tbl);
+        auto it = std::lower_bound(first, last, name,
+                                   [this](const slot &entry, std::string_view k)
+                                   { return key(entry) < k; });
+        return it != last && key(*it) == name ? it : nullptr;
+    }
+
+    const slot *at(const slot &arr, size_t index) const noexcept
+    {
+        return index < arr.data.range.size ? children_begin(arr) + index : nullptr;
+    }
+
+    std::shared_ptr<node> materialize(const slot &s) const
+    {
+        switch (s.type)
+        {
+        case base_type::String:
+            return make_value(std::string{text(s)});
+        case base_type::Integer:
+            return make_value(s.data.integer);
+        case base_type::Float:
+            return make_value(s.data.floating);
+        case base_type::Boolean:
+            return make_value(bool{s.data.boolean});
+        case base_type::OffsetDateTime:
+            return make_value(*value<offset_date_time>(s));
+        case base_type::LocalDateTime:
+            return make_value(*value<local_date_time>(s));
+        case base_type::LocalDate:
+            return make_value(*value<local_date>(s));
+        case base_type::LocalTime:
+            return make_value(*value<local_time>(s));
+        case base_type::Table:
+        {
+            auto result = make_table(s.flags & detail::slot_inline_table);
+            for (auto it = children_begin(s); it != children_end(s); ++it)
+            {
+                result->emplace(key(*it), materialize(*it));
+            }
+            return result;
+        }
+        case base_type::Array:
+        case base_type::TableArray:
+        {
+            auto result = make_array();
+            result->reserve(s.data.range.size);
+            for (auto it = children_begin(s); it != children_end(s); ++it)
+            {
+                result->push_back(materialize(*it));
+            }
+            return result;
+        }
+        default:
+            return nullptr;
+        }
+    }
+
+    uint32_t checked_offset(size_t offset) const
+    {
+        if (offset > std::numeric_limits<uint32_t>::max())
+        {
+            throw std::length_error("toml document is too large for compact storage");
+        }
+        return static_cast<uint32_t>(offset);
+    }
+
+    void append_string(slot &s, std::string_view str)
+    {
+        s.data.range.offset = checked_offset(strings_.size());
+        s.data.range.size = checked_offset(str.size());
+        strings_.append(str);
+    }
+
+    template <class T>
+    void store(slot &s, const node &n)
+    {
+        auto val = static_cast<const toml::value<T> &>(n).get();
+        std::memcpy(s.data.bytes, static_cast<const void *>(&val), sizeof(T));
+    }
+
+    void assign(slot &s, const node &n)
+    {
+        s.type = n.type();
+        switch (s.type)
+        {
+        case base_type::String:
+            append_string(s, static_cast<const toml::value<std::string> &>(n).get());
+            break;
+        case base_type::Integer:
+            s.data.integer = static_cast<const toml::value<int64_t> &>(n).get();
+            break;
+        case base_type::Float:
+            s.data.floating = static_cast<const toml::value<double> &>(n).get();
+            break;
+        case base_type::Boolean:
+            s.data.boolean = static_cast<const toml::value<bool> &>(n).get();
+            break;
+        case base_type::OffsetDateTime:
+            store<offset_date_time>(s, n);
+            break;
+        case base_type::LocalDateTime:
+            store<local_date_time>(s, n);
+            break;
+        case base_type::LocalDate:
+            store<local_date>(s, n);
+            break;
+        case base_type::LocalTime:
+            store<local_time>(s, n);
+            break;
+        case base_type::Table:
+            if (static_cast<const table &>(n).is_inline())
+            {
+                s.flags |= detail::slot_inline_table;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    /**
+     * Lays the tree out breadth-first, so that the children of every
+     * container end up next to each other.
+     */
+    void build(const table &root)
+    {
+        std::unordered_map<std::string_view, uint32_t> key_offsets;
+        std::vector<std::pair<size_t, const node *>> pending{{0, &root}};
+        std::vector<std::pair<std::string_view, const node *>> entries;
+
+        slots_.push_back(slot{});
+        slots_.front().type = base_type::Table;
+
+        for (size_t i = 0; i < pending.size(); ++i)
+        {
+            auto [index, parent] = pending[i];
+            auto first = slots_.size();
+
+            entries.clear();
+            if (parent->is_table())
+            {
+                for (const auto &[k, child] : static_cast<const table &>(*parent))
+                {
+                    entries.emplace_back(k, child.get());
+                }
+                std::sort(entries.begin(), entries.end(),
+                          [](const auto &a, const auto &b)
+                          { return a.first < b.first; });
+            }
+            else
+            {
+                for (const auto &child : static_cast<const array &>(*parent))
+                {
+                    entries.emplace_back(std::string_view{}, child.get());
+                }
+            }
+
+            slots_[index].data.range.offset = checked_offset(first);
+            slots_[index].data.range.size = checked_offset(entries.size());
+            slots_.resize(first + entries.size(), slot{});
+
+            for (size_t j = 0; j < entries.size(); ++j)
+            {
+                auto &[k, child] = entries[j];
+                auto &s = slots_[first + j];
+                if (!k.empty())
+                {
+                    auto [pos, inserted] = key_offsets.try_emplace(k, 0);
+                    if (inserted)
+                    {
+                        pos->second = checked_offset(strings_.size());
+                        strings_.append(k);
+                    }
+                    s.key_offset = pos->second;
+                    s.key_size = checked_offset(k.size());
+                }
+
+                assign(s, *child);
+                if (is_container(s))
+                {
+                    pending.emplace_back(first + j, child);
+                }
+            }
+        }
+
+        slots_.shrink_to_fit();
+        strings_.shrink_to_fit();
+        slot_data_ = slots_;
+        string_pool_ = strings_;
+    }
+
+    /**
+     * Takes the slots and strings of a mapped image, or returns nullptr if
+     * the file is not an image this build can read or its source differs
+     * from the expected one.
+     */
+    static std::shared_ptr<const document> load(mapped_file &&file, const source_stamp *expected)
+    {
+        detail::doc_image_header header;
+        if (!file.is_open() || file.size() < sizeof(header))
+        {
+            return nullptr;
+        }
+
+        std::memcpy(&header, file.data(), sizeof(header));
+        if (std::memcmp(header.magic, detail::doc_image_magic, sizeof(header.magic)) != 0 ||
+            header.version != detail::doc_image_version ||
+            header.byte_order != detail::doc_image_byte_order ||
+            header.slot_size != sizeof(slot) ||
+            (expected && header.source != *expected))
+        {
+            return nullptr;
+        }
+
+        const auto body = file.size() - sizeof(header);
+        if (header.slot_count == 0 || header.slot_count > body / sizeof(slot) ||
+            header.string_size != body - header.slot_count * sizeof(slot) ||
+            reinterpret_cast<uintptr_t>(file.data()) % alignof(slot) != 0)
+        {
+            return nullptr;
+        }
+
+        auto result = std::make_shared<document>(make_shared_enabler{});
+        result->image_ = std::move(file);
+        const char *slots = result->image_.data() + sizeof(header);
+        result->slot_data_ = {reinterpret_cast<const slot *>(slots), static_cast<size_t>(header.slot_count)};
+        result->string_pool_ = {slots + header.slot_count * sizeof(slot), static_cast<size_t>(header.string_size)};
+        return result->is_well_formed() ? result : nullptr;
+    }
+
+    /**
+     * Whether every offset of a loaded image stays inside it. Children
+     * always come after their container, so a well-formed image has no
+     * cycles.
+     */
+    bool is_well_formed() const noexcept
+    {
+        if (root().type != base_type::Table)
+        {
+            return false;
+        }
+
+        const auto within = [](uint64_t offset, uint64_t size, uint64_t limit)
+        {
+            return offset + size <= limit;
+        };
+        for (size_t i = 0; i < slot_data_.size(); ++i)
+        {
+            const auto &s = slot_data_[i];
+            if (!within(s.key_offset, s.key_size, string_pool_.size()))
+            {
+                return false;
+            }
+
+            switch (s.type)
+            {
+            case base_type::String:
+                if (!within(s.data.range.offset, s.data.range.size, string_pool_.size()))
+                    return false;
+                break;
+            case base_type::Boolean:
+                if (s.data.bytes[0] > 1)
+                    return false;
+                break;
+            case base_type::Integer:
+            case base_type::Float:
+            case base_type::OffsetDateTime:
+            case base_type::LocalDateTime:
+            case base_type::LocalDate:
+            case base_type::LocalTime:
+                break;
+            case base_type::Table:
+            case base_type::Array:
+            case base_type::TableArray:
+                if (s.data.range.offset <= i ||
+                    !within(s.data.range.offset, s.data.range.size, slot_data_.size()))
+                    return false;
+                break;
+            default:
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+/**
+ * Copies a node tree into a compact document.
+ */
+inline std::shared_ptr<const document> make_document(const table &root)
+{
+    auto result = std::make_shared<document>(document::make_shared_enabler{});
+    result->build(root);
+    return result;
+}
+
+/**
+ * Maps a document image written from document::image(). Nothing is copied
+ * or decoded: values are read straight from the mapping, which stays open
+ * as long as the document is alive.
+ * @return nullptr if the file cannot be opened or is not a readable image
+ */
+inline std::shared_ptr<const document> load_document(const std::string &file_path)
+{
+    return document::load(mapped_file{file_path}, nullptr);
+}
+
+/**
+ * Maps a document image only if it was made from the expected source.
+ */
+inline std::shared_ptr<const document> load_document(const std::string &file_path,
+                                                     const source_stamp &expected)
+{
+    return document::load(mapped_file{file_path}, &expected);
+}
+
+TOML_NAMESPACE_END
+} // namespace toml
@@ -0,0 +1,1565 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <charconv>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "base.h"
+#include "date_time.h"
+#include "mapped_file.h"
+#include "scan.h"
+
+namespace toml
+{
+TOML_NAMESPACE_BEGIN
+
+struct source_position
+{
+    size_t line;   // The line number starting at 1
+    size_t column; // The column number starting at 1
+};
+
+class parse_error : public std::runtime_error
+{
+public:
+    parse_error(const std::string &desc) noexcept
+        : std::runtime_error{desc.data()} {}
+
+    parse_error(const std::string &desc, size_t line_number) noexcept
+        : std::runtime_error{desc.data()},
+          source_{line_number, 0} {}
+
+    parse_error(const std::string &desc, const source_position &source) noexcept
+        : std::runtime_error{desc.data()},
+          source_{source} {}
+
+    std::string_view description() const noexcept
+    {
+        return std::string_view{what()};
+    }
+
+    const source_position &source() const noexcept
+    {
+        return source_;
+    }
+
+private:
+    source_position source_;
+};
+
+/**
+ * Helper object for consuming expected characters.
+ */
+class consumer
+{
+public:
+    consumer(const char *&it,
+             const char *const &end,
+             std::function<void()> on_error)
+        : it_(it),
+          end_(end),
+          on_error_(on_error) {}
+
+    void operator()(char c)
+    {
+        if (it_ == end_ || *it_ != c)
+            on_error_();
+        ++it_;
+    }
+
+    template <std::size_t N>
+    void operator()(const char (&str)[N])
+    {
+        std::for_each(std::begin(str), std::end(str) - 1,
+                      [&](char c)
+                      { (*this)(c); });
+    }
+
+    void eat_either(char a, char b)
+    {
+        if (it_ == end_ || (*it_ != a && *it_ != b))
+            on_error_();
+        ++it_;
+    }
+
+    int eat_digits(int len)
+    {
+        int val = 0;
+        for (int i = 0; i < len; ++i)
+        {
+            if (it_ == end_ || !std::isdigit(static_cast<unsigned char>(*it_)))
+                on_error_();
+            val = 10 * val + (*it_++ - '0');
+        }
+        return val;
+    }
+
+private:
+    const char *&it_;
+    const char *const &end_;
+    std::function<void()> on_error_;
+};
+
+namespace detail
+{
+/**
+ * Stands in for the std::string a string value is decoded into when the
+ * string is only checked.
+ */
+struct null_string
+{
+    void clear() noexcept {}
+
+    template <class It>
+    void append(It, It) noexcept {}
+
+    null_string &operator+=(char) noexcept
+    {
+        return *this;
+    }
+};
+} // namespace detail
+
+/**
+ * A handler for event_parser that ignores every event.
+ *
+ * Handlers derive from it and declare the events they are interested in,
+ * which hide the ones here. A handler that declares some overloads of
+ * on_value should bring the others into scope with
+ * `using event_handler::on_value;`. Keys and table names are only valid
+ * for the duration of the call. Handlers report errors by throwing a
+ * parse_error.
+ */
+struct event_handler
+{
+    /**
+     * A [table] header, or a [[table-array]] header if is_array is set,
+     * with the parts of its dotted name.
+     */
+    void on_table_header(span<const std::string> /*name*/, bool /*is_array*/,
+                         const source_position & /*position*/)
+    {
+    }
+
+    /**
+     * The (dotted) key of a key/value pair, in the current table or inline
+     * table. Its value is the next value, array or inline table.
+     */
+    void on_key(span<const std::string> /*key*/, const source_position & /*position*/)
+    {
+    }
+
+    /**
+     * A value: a std::string, int64_t, double, bool, local_date,
+     * local_time, local_date_time or offset_date_time.
+     */
+    template <class T>
+    void on_value(T && /*val*/, const source_position & /*position*/)
+    {
+    }
+
+    /**
+     * Whether string values are passed to on_raw_string instead of
+     * on_value.
+     */
+    bool raw_strings() const noexcept
+    {
+        return false;
+    }
+
+    /**
+     * A string value in its source form, quotes included, already checked
+     * to be well-formed; decode_string() turns it into its value.
+     */
+    void on_raw_string(std::string_view /*source*/, const source_position & /*position*/)
+    {
+    }
+
+    void on_array_begin(const source_position & /*position*/)
+    {
+    }
+
+    void on_array_end(const source_position & /*position*/)
+    {
+    }
+
+    void on_inline_table_begin(const source_position & /*position*/)
+    {
+    }
+
+    void on_inline_table_end(const source_position & /*position*/)
+    {
+    }
+};
+
+/**
+ * Parses a document into a sequence of events passed to a handler (see
+ * event_handler) without building any nodes. The parser checks the
+ * grammar only: rules that need the whole document, like keys being
+ * defined only once, are left to the handler.
+ */
+template <class Handler>
+class event_parser
+{
+public:
+    using iterator = const char *;
+
+    /**
+     * Event parsers are constructed over a contiguous buffer, which must
+     * outlive the call to parse(). The lines of the buffer are numbered
+     * from first_line, for parsing a piece of a larger document.
+     */
+    event_parser(std::string_view source, Handler &handler, size_t first_line = 1)
+        : handler_(handler),
+          cursor_(source.data()),
+          source_end_(source.data() + source.size()),
+          line_begin_(source.data()),
+          line_number_(first_line - 1) {}
+
+    event_parser(const event_parser &) = delete;
+    event_parser &operator=(const event_parser &) = delete;
+
+    /**
+     * Parses the buffer this parser was created on until the end.
+     * @throw parse_error if there are errors in parsing
+     */
+    void parse()
+    {
+        iterator it;
+        iterator end;
+        while (next_line(it, end))
+        {
+            consume_whitespace(it, end);
+            if (it == end || *it == '#')
+                continue;
+            if (*it == '[')
+            {
+                parse_table(it, end);
+            }
+            else
+            {
+                parse_key_value(it, end);
+                consume_whitespace(it, end);
+                eol_or_comment(it, end);
+            }
+        }
+    }
+
+    /**
+     * Parses the buffer as a single value, e.g. one kept in its source form.
+     * @throw parse_error if there are errors in parsing
+     */
+    void parse_value()
+    {
+        iterator it;
+        iterator end;
+        if (!next_line(it, end))
+            throw_parse_exception("Failed to parse value");
+        parse_value(it, end);
+    }
+
+private:
+#if defined _MSC_VER
+    __declspec(noreturn)
+#elif defined __GNUC__
+    __attribute__((noreturn))
+#endif
+    void
+    throw_parse_exception(const std::string &err)
+    {
+        throw parse_error{err, line_number_};
+    }
+
+    source_position position(iterator it) const noexcept
+    {
+        return {line_number_, static_cast<size_t>(it - line_begin_) + 1};
+    }
+
+    /**
+     * Advances the cursor to the next line of the buffer, setting [it, end)
+     * to its contents without the line terminator ("\n" or "\r\n").
+     * Returns false once the whole buffer has been consumed.
+     */
+    bool next_line(iterator &it, iterator &end) noexcept
+    {
+        if (cursor_ == source_end_)
+            return false;
+
+        ++line_number_;
+        it = line_begin_ = cursor_;
+
+        auto eol = static_cast<iterator>(std::memchr(cursor_, '\n', source_end_ - cursor_));
+        if (eol == nullptr)
+        {
+            end = cursor_ = source_end_;
+        }
+        else
+        {
+            cursor_ = eol + 1;
+            end = (eol != it && eol[-1] == '\r') ? eol - 1 : eol;
+        }
+        return true;
+    }
+
+    /**
+     * The parts of the key parsed last. Their buffers are reused from one
+     * key to the next.
+     */
+    span<const std::string> key() const noexcept
+    {
+        return {key_parts_.data(), key_size_};
+    }
+
+    std::string &next_key_part()
+    {
+        if (key_size_ == key_parts_.size())
+            key_parts_.emplace_back();
+        auto &part = key_parts_[key_size_++];
+        part.clear();
+        return part;
+    }
+
+    void parse_table(iterator &it,
+                     const iterator &end)
+    {
+        auto pos = position(it);
+
+        // remove the beginning keytable marker
+        ++it;
+        if (it == end)
+            throw_parse_exception("Unexpected end of table");
+        if (*it == '[')
+            parse_table_array(it, end, pos);
+        else
+            parse_single_table(it, end, pos);
+    }
+
+    void parse_single_table(iterator &it,
+                            const iterator &end,
+                            const source_position &pos)
+    {
+        if (it == end || *it == ']')
+            throw_parse_exception("Table name cannot be empty");
+
+        parse_key(it, end, ']');
+
+        for (const auto &part : key())
+        {
+            if (part.empty())
+                throw_parse_exception("Empty component of table name");
+        }
+
+        if (it == end)
+            throw_parse_exception(
+                "Unterminated table declaration; did you forget a ']'?");
+
+        if (*it != ']')
+        {
+            std::string errmsg{"Unexpected character in table definition: "};
+            errmsg += '"';
+            errmsg += *it;
+            errmsg += '"';
+            throw_parse_exception(errmsg);
+        }
+
+        handler_.on_table_header(key(), false, pos);
+
+        ++it;
+        consume_whitespace(it, end);
+        eol_or_comment(it, end);
+    }
+
+    void parse_table_array(iterator &it,
+                           const iterator &end,
+                           const source_position &pos)
+    {
+        ++it;
+        if (it == end || *it == ']')
+            throw_parse_exception("Table array name cannot be empty");
+
+        parse_key(it, end, ']');
+
+        for (const auto &part : key())
+        {
+            if (part.empty())
+                throw_parse_exception("Empty component of table array name");
+        }
+
+        // consume the last "]]"
+        auto eat = consumer(it, end, [&]()
+                            { throw_parse_exception("Unterminated table array name"); });
+        eat(']');
+        eat(']');
+
+        handler_.on_table_header(key(), true, pos);
+
+        consume_whitespace(it, end);
+        eol_or_comment(it, end);
+    }
+
+    void parse_key_value(iterator &it, iterator &end)
+    {
+        auto pos = position(it);
+        handler_.on_key(parse_key(it, end, '='), pos);
+
+        if (it == end || *it != '=')
+            throw_parse_exception("Value must follow after a '='");
+        ++it;
+        consume_whitespace(it, end);
+        parse_value(it, end);
+        consume_whitespace(it, end);
+    }
+
+    /**
+     * Parses a key as a series of one or more simple keys joined with '.',
+     * up to key_end.
+     */
+    span<const std::string> parse_key(iterator &it, const iterator &end, char key_end)
+    {
+        key_size_ = 0;
+        while (it != end && *it != key_end)
+        {
+            parse_simple_key(it, end, next_key_part());
+            consume_whitespace(it, end);
+
+            if (it == end || *it == key_end)
+            {
+                return key();
+            }
+
+            if (*it != '.')
+            {
+                std::string errmsg{"Unexpected character in key: "};
+                errmsg += '"';
+                errmsg += *it;
+                errmsg += '"';
+                throw_parse_exception(errmsg);
+            }
+
+            // consume the dot
+            ++it;
+        }
+
+        throw_parse_exception("Unexpected end of key");
+    }
+
+    void parse_simple_key(iterator &it,
+                          const iterator &end,
+                          std::string &key)
+    {
+        consume_whitespace(it, end);
+
+        if (it == end)
+            throw_parse_exception("Unexpected end of key (blank key?)");
+
+        if (*it == '"' || *it == '\'')
+        {
+            string_literal(it, end, *it, key);
+        }
+        else
+        {
+            parse_bare_key(it, end, key);
+        }
+    }
+
+    void parse_bare_key(iterator &it,
+                        const iterator &end,
+                        std::string &key)
+    {
+        auto key_end = detail::find_bare_key_end(it, end);
+        auto next = detail::skip_whitespace(key_end, end);
+
+        if (next != end && *next != '.' && *next != '=' && *next != ']')
+        {
+            throw_bare_key_exception(it, end);
+        }
+
+        if (key_end == it)
+        {
+            throw_parse_exception("Bare key missing name");
+        }
+
+        key.assign(it, key_end);
+        it = key_end;
+    }
+
+#if defined _MSC_VER
+    __declspec(noreturn)
+#elif defined __GNUC__
+    __attribute__((noreturn))
+#endif
+    void
+    throw_bare_key_exception(iterator it, const iterator &end)
+    {
+        // describe the whole offending key, i.e. everything up to the next
+        // character that could have ended it
+        auto bke = std::find_if(it, end, [](char c)
+                                { return c == '.' || c == '=' || c == ']'; });
+        auto key_end = bke;
+        if (key_end != it)
+        {
+            --key_end;
+            consume_backwards_whitespace(key_end, it);
+            ++key_end;
+        }
+        std::string key{it, key_end};
+
+        if (std::find(it, key_end, '#') != key_end)
+        {
+            throw_parse_exception("Bare key " + key + " cannot contain #");
+        }
+
+        if (std::find_if(it, key_end,
+                         [](char c)
+                         { return c == ' ' || c == '\t'; }) != key_end)
+        {
+            throw_parse_exception("Bare key " + key + " cannot contain whitespace");
+        }
+
+        if (std::find_if(it, key_end,
+                         [](char c)
+                         { return c == '[' || c == ']'; }) != key_end)
+        {
+            throw_parse_exception("Bare key " + key + " cannot contain '[' or ']'");
+        }
+
+        auto bad = detail::find_bare_key_end(it, key_end);
+        throw_parse_exception("Bare key " + key + " cannot contain '" + std::string{*bad} + "'");
+    }
+
+    enum class numeric_type : uint8_t
+    {
+        None = 0,
+        LocalTime,
+        LocalDate,
+        LocalDateTime,
+        OffsetDateTime,
+        Integer,
+        Float,
+    };
+
+    void parse_value(iterator &it,
+                     iterator &end)
+    {
+        if (it == end)
+        {
+            throw_parse_exception("Failed to parse value");
+        }
+        else if (*it == '[')
+        {
+            // parse array
+            parse_array(it, end);
+        }
+        else if (*it == '{')
+        {
+            // parse inline table
+            parse_inline_table(it, end);
+        }
+        else if (*it == '"' || *it == '\'')
+        {
+            // STRING:
+            parse_string(it, end);
+        }
+        else if (*it == 't' || *it == 'f')
+        {
+            // BOOL;
+            parse_bool(it, end);
+        }
+        else
+        {
+            auto val_end = std::find_if(
+                it, end, [](char c)
+                { return c == ',' || c == ']' || c == '#'; });
+
+            numeric_type type = determine_numeric_type(it, val_end);
+
+            switch (type)
+            {
+            case numeric_type::LocalTime:
+                parse_time(it, end);
+                break;
+            case numeric_type::LocalDate:
+            case numeric_type::LocalDateTime:
+            case numeric_type::OffsetDateTime:
+                parse_date(it, end);
+                break;
+            case numeric_type::Integer:
+            case numeric_type::Float:
+                parse_number(it, end);
+                break;
+            default:
+                throw_parse_exception("Failed to parse value");
+            }
+        }
+    }
+
+    numeric_type determine_numeric_type(const iterator &it,
+                                        const iterator &end)
+    {
+        if (it == end)
+        {
+            return numeric_type::None;
+        }
+        else if (is_time(it, end))
+        {
+            return numeric_type::LocalTime;
+        }
+        else if (auto date_type = determine_date_type(it, end); date_type != numeric_type::None)
+        {
+            return date_type;
+        }
+        else if (std::isdigit(static_cast<unsigned char>(*it)) || *it == '-' || *it == '+' ||
+                 (*it == 'i' && it + 1 != end && it[1] == 'n' && it + 2 != end && it[2] == 'f') ||
+                 (*it == 'n' && it + 1 != end && it[1] == 'a' && it + 2 != end && it[2] == 'n'))
+        {
+            return determine_number_type(it, end);
+        }
+        else
+        {
+            return numeric_type::None;
+        }
+    }
+
+    numeric_type determine_number_type(const iterator &it,
+                                       const iterator &end)
+    {
+        // determine if we are an integer or a float
+        auto check_it = it;
+        if (*check_it == '-' || *check_it == '+')
+            ++check_it;
+
+        if (check_it == end)
+            return numeric_type::None;
+
+        if (*check_it == 'i' || *check_it == 'n')
+            return numeric_type::Float;
+
+        while (check_it != end && std::isdigit(static_cast<unsigned char>(*check_it)))
+            ++check_it;
+        if (check_it != end && *check_it == '.')
+        {
+            ++check_it;
+            while (check_it != end && std::isdigit(static_cast<unsigned char>(*check_it)))
+                ++check_it;
+            return numeric_type::Float;
+        }
+        else
+        {
+            return numeric_type::Integer;
+        }
+    }
+
+    void parse_string(iterator &it,
+                      iterator &end)
+    {
+        auto pos = position(it);
+        auto delim = *it;
+        assert(delim == '"' || delim == '\'');
+
+        // end is non-const here because we have to be able to potentially
+        // parse multiple lines in a string, not just one
+        auto multiline = false;
+        auto check_it = it;
+        ++check_it;
+        if (check_it != end && *check_it == delim)
+        {
+            ++check_it;
+            multiline = check_it != end && *check_it == delim;
+        }
+
+        if (handler_.raw_strings())
+        {
+            // only check the string, and hand out its source
+            auto raw = it;
+            detail::null_string val;
+            if (multiline)
+            {
+                it = ++check_it;
+                parse_multiline_string(it, end, delim, val);
+                handler_.on_raw_string({raw, static_cast<size_t>(it - raw)}, pos);
+            }
+            else
+            {
+                string_literal(it, end, delim, val);
+                auto raw_end = it;
+                while (raw_end[-1] != delim)
+                    --raw_end;
+                handler_.on_raw_string({raw, static_cast<size_t>(raw_end - raw)}, pos);
+            }
+            return;
+        }
+
+        // strings are built in a buffer of the parser, which keeps its
+        // capacity unless the handler takes the value
+        auto &val = string_;
+        val.clear();
+        if (multiline)
+        {
+            it = ++check_it;
+            parse_multiline_string(it, end, delim, val);
+        }
+        else
+        {
+            string_literal(it, end, delim, val);
+        }
+        handler_.on_value(std::move(val), pos);
+    }
+
+    template <class String>
+    void parse_multiline_string(iterator &it,
+                                iterator &end, char delim, String &val)
+    {
+        bool consuming = false;
+        bool closed = false;
+
+        auto handle_line = [&](iterator &local_it,
+                               iterator &local_end)
+        {
+            if (consuming)
+            {
+                local_it = detail::skip_whitespace(local_it, local_end);
+
+                // whole line is whitespace
+                if (local_it == local_end)
+                    return;
+            }
+
+            consuming = false;
+
+            while (local_it != local_end)
+            {
+                // copy everything up to the next quote or backslash at once
+                auto run_end = detail::find_string_special(local_it, local_end, delim);
+                val.append(local_it, run_end);
+                local_it = run_end;
+
+                if (local_it == local_end)
+                    break;
+
+                // handle escaped characters
+                if (delim == '"' && *local_it == '\\')
+                {
+                    auto check = local_it;
+                    // check if this is an actual escape sequence or a
+                    // whitespace escaping backslash
+                    ++check;
+                    consume_whitespace(check, local_end);
+                    if (check == local_end)
+                    {
+                        consuming = true;
+                        break;
+                    }
+
+                    parse_escape_code(local_it, local_end, val);
+                    continue;
+                }
+
+                // if we can end the string
+                if (std::distance(local_it, local_end) >= 3)
+                {
+                    auto check = local_it;
+                    // check for """
+                    if (*check++ == delim && *check++ == delim && *check++ == delim)
+                    {
+                        local_it = check;
+                        closed = true;
+                        break;
+                    }
+                }
+
+                val += *local_it++;
+            }
+        };
+
+        // handle the remainder of the current line
+        handle_line(it, end);
+        if (closed)
+            return;
+
+        // start eating lines
+        while (next_line(it, end))
+        {
+            handle_line(it, end);
+
+            if (closed)
+                return;
+
+            if (!consuming)
+                val += '\n';
+        }
+
+        throw_parse_exception("Unterminated multi-line basic string");
+    }
+
+    /**
+     * Appends the contents of a single-line string to val.
+     */
+    template <class String>
+    void string_literal(iterator &it,
+                        const iterator &end, char delim, String &val)
+    {
+        ++it;
+        while (it != end)
+        {
+            // copy everything up to the next quote or backslash at once
+            auto run_end = detail::find_string_special(it, end, delim);
+            val.append(it, run_end);
+            it = run_end;
+
+            if (it == end)
+            {
+                break;
+            }
+            // handle escaped characters
+            else if (delim == '"' && *it == '\\')
+            {
+                parse_escape_code(it, end, val);
+            }
+            else if (*it == delim)
+            {
+                ++it;
+                consume_whitespace(it, end);
+                return;
+            }
+            else
+            {
+                val += *it++;
+            }
+        }
+        throw_parse_exception("Unterminated string literal");
+    }
+
+    template <class String>
+    void parse_escape_code(iterator &it,
+                           const iterator &end, String &val)
+    {
+        ++it;
+        if (it == end)
+            throw_parse_exception("Invalid escape sequence");
+        char value;
+        if (*it == 'b')
+        {
+            value = '\b';
+        }
+        else if (*it == 't')
+        {
+            value = '\t';
+        }
+        else if (*it == 'n')
+        {
+            value = '\n';
+        }
+        else if (*it == 'f')
+        {
+            value = '\f';
+        }
+        else if (*it == 'r')
+        {
+            value = '\r';
+        }
+        else if (*it == '"')
+        {
+            value = '"';
+        }
+        else if (*it == '\\')
+        {
+            value = '\\';
+        }
+        else if (*it == 'u' || *it == 'U')
+        {
+            parse_unicode(it, end, val);
+            return;
+        }
+        else
+        {
+            throw_parse_exception("Invalid escape sequence");
+        }
+        ++it;
+        val += value;
+    }
+
+    template <class String>
+    void parse_unicode(iterator &it,
+                       const iterator &end, String &result)
+    {
+        bool large = *it++ == 'U';
+        auto codepoint = parse_hex(it, end, large ? 0x10000000 : 0x1000);
+
+        if ((codepoint > 0xd7ff && codepoint < 0xe000) || codepoint > 0x10ffff)
+        {
+            throw_parse_exception(
+                "Unicode escape sequence is not a Unicode scalar value");
+        }
+
+        // See Table 3-6 of the Unicode standard
+        if (codepoint <= 0x7f)
+        {
+            // 1-byte codepoints: 00000000 0xxxxxxx
+            // repr: 0xxxxxxx
+            result += static_cast<char>(codepoint & 0x7f);
+        }
+        else if (codepoint <= 0x7ff)
+        {
+            // 2-byte codepoints: 00000yyy yyxxxxxx
+            // repr: 110yyyyy 10xxxxxx
+            //
+            // 0x1f = 00011111
+            // 0xc0 = 11000000
+            //
+            result += static_cast<char>(0xc0 | ((codepoint >> 6) & 0x1f));
+            //
+            // 0x80 = 10000000
+            // 0x3f = 00111111
+            //
+            result += static_cast<char>(0x80 | (codepoint & 0x3f));
+        }
+        else if (codepoint <= 0xffff)
+        {
+            // 3-byte codepoints: zzzzyyyy yyxxxxxx
+            // repr: 1110zzzz 10yyyyyy 10xxxxxx
+            //
+            // 0xe0 = 11100000
+            // 0x0f = 00001111
+            //
+            result += static_cast<char>(0xe0 | ((codepoint >> 12) & 0x0f));
+            result += static_cast<char>(0x80 | ((codepoint >> 6) & 0x1f));
+            result += static_cast<char>(0x80 | (codepoint & 0x3f));
+        }
+        else
+        {
+            // 4-byte codepoints: 000uuuuu zzzzyyyy yyxxxxxx
+            // repr: 11110uuu 10uuzzzz 10yyyyyy 10xxxxxx
+            //
+            // 0xf0 = 11110000
+            // 0x07 = 00000111
+            //
+            result += static_cast<char>(0xf0 | ((codepoint >> 18) & 0x07));
+            result += static_cast<char>(0x80 | ((codepoint >> 12) & 0x3f));
+            result += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3f));
+            result += static_cast<char>(0x80 | (codepoint & 0x3f));
+        }
+    }
+
+    uint32_t parse_hex(iterator &it,
+                       const iterator &end, uint32_t place)
+    {
+        uint32_t value = 0;
+        while (place > 0)
+        {
+            if (it == end)
+                throw_parse_exception("Unexpected end of unicode sequence");
+
+            if (!std::isxdigit(static_cast<unsigned char>(*it)))
+                throw_parse_exception("Invalid unicode escape sequence");
+
+            value += place * hex_to_digit(*it++);
+            place /= 16;
+        }
+        return value;
+    }
+
+    uint32_t hex_to_digit(char c)
+    {
+        if (std::isdigit(static_cast<unsigned char>(c)))
+        {
+            return static_cast<uint32_t>(c - '0');
+        }
+        else
+        {
+            return 10 + static_cast<uint32_t>(c - ((c >= 'a' && c <= 'f') ? 'a' : 'A'));
+        }
+    }
+
+    void parse_number(iterator &it,
+                      const iterator &end)
+    {
+        auto pos = position(it);
+        auto check_it = it;
+        auto check_end = find_end_of_number(it, end);
+
+        auto eat_sign = [&]()
+        {
+            if (check_it != end && (*check_it == '-' || *check_it == '+'))
+                ++check_it;
+        };
+
+        auto check_no_leading_zero = [&]()
+        {
+            if (check_it != end && *check_it == '0' && check_it + 1 != check_end && check_it[1] != '.')
+            {
+                throw_parse_exception("Numbers may not have leading zeros");
+            }
+        };
+
+        auto eat_digits = [&](std::function<bool(char)> &&check_char)
+        {
+            auto beg = check_it;
+            while (check_it != end && check_char(*check_it))
+            {
+                ++check_it;
+                if (check_it != end && *check_it == '_')
+                {
+                    ++check_it;
+                    if (check_it == end || !check_char(*check_it))
+                        throw_parse_exception("Malformed number 1");
+                }
+            }
+
+            if (check_it == beg)
+                throw_parse_exception("Malformed number 2");
+        };
+
+        auto eat_hex = [&]()
+        {
+            eat_digits([](char c) -> bool
+                       { return std::isxdigit(static_cast<unsigned char>(c)); });
+        };
+        auto eat_decimal = [&]()
+        {
+            eat_digits([](char c) -> bool
+                       { return std::isdigit(static_cast<unsigned char>(c)); });
+        };
+
+        if (check_it != end && *check_it == '0' && check_it + 1 != check_end &&
+            (check_it[1] == 'x' || check_it[1] == 'o' || check_it[1] == 'b'))
+        {
+            ++check_it;
+            char base = *check_it;
+            ++check_it;
+
+            // the digits are converted without the 0x/0o/0b prefix
+            it = check_it;
+            if (base == 'x')
+            {
+                eat_hex();
+                handler_.on_value(read_int(it, check_it, 16), pos);
+            }
+            else if (base == 'o')
+            {
+                eat_decimal();
+                handler_.on_value(read_int(it, check_it, 8), pos);
+            }
+            else // if (base == 'b')
+            {
+                eat_decimal();
+                handler_.on_value(read_int(it, check_it, 2), pos);
+            }
+            return;
+        }
+
+        eat_sign();
+        check_no_leading_zero();
+
+        if (check_it != end && check_it + 1 != end && check_it + 2 != end)
+        {
+            if (check_it[0] == 'i' && check_it[1] == 'n' && check_it[2] == 'f')
+            {
+                auto val = std::numeric_limits<double>::infinity();
+                if (*it == '-')
+                    val = -val;
+                it = check_it + 3;
+                handler_.on_value(std::move(val), pos);
+                return;
+            }
+            else if (check_it[0] == 'n' && check_it[1] == 'a' && check_it[2] == 'n')
+            {
+                auto val = std::numeric_limits<double>::quiet_NaN();
+                if (*it == '-')
+                    val = -val;
+                it = check_it + 3;
+                handler_.on_value(std::move(val), pos);
+                return;
+            }
+        }
+
+        eat_decimal();
+
+        if (check_it != end && (*check_it == '.' || *check_it == 'e' || *check_it == 'E'))
+        {
+            bool is_exp = *check_it == 'e' || *check_it == 'E';
+
+            ++check_it;
+            if (check_it == end)
+                throw_parse_exception("Floats must have trailing digits");
+
+            auto eat_exp = [&]()
+            {
+                eat_sign();
+                check_no_leading_zero();
+                eat_decimal();
+            };
+
+            if (is_exp)
+                eat_exp();
+            else
+                eat_decimal();
+
+            if (!is_exp && check_it != end && (*check_it == 'e' || *check_it == 'E'))
+            {
+                ++check_it;
+                eat_exp();
+            }
+
+            handler_.on_value(read_float(it, check_it), pos);
+        }
+        else
+        {
+            handler_.on_value(read_int(it, check_it), pos);
+        }
+    }
+
+    /**
+     * Returns the characters of a number token in a form std::from_chars
+     * accepts: without digit separators or a leading '+'. Tokens that need
+     * no rewriting are returned as a view of the source; the others are
+     * copied into buf, or into spill if they do not fit.
+     */
+    template <size_t N>
+    std::string_view number_digits(iterator first, iterator last,
+                                   char (&buf)[N], std::string &spill)
+    {
+        if (first != last && *first == '+')
+            ++first;
+
+        auto size = static_cast<size_t>(last - first);
+        if (std::memchr(first, '_', size) == nullptr)
+            return {first, size};
+
+        char *out = buf;
+        if (size > N)
+        {
+            spill.resize(size);
+            out = spill.data();
+        }
+
+        auto out_end = std::remove_copy(first, last, out, '_');
+        return {out, static_cast<size_t>(out_end - out)};
+    }
+
+    void check_conversion(const std::from_chars_result &result,
+                          const std::string_view &digits)
+    {
+        if (result.ec == std::errc::result_out_of_range)
+            throw_parse_exception("Malformed number (out of range)");
+        if (result.ec != std::errc{} || result.ptr != digits.data() + digits.size())
+            throw_parse_exception("Malformed number (invalid argument)");
+    }
+
+    int64_t read_int(iterator &it,
+                     const iterator &end,
+                     int base = 10)
+    {
+        char buf[96];
+        std::string spill;
+        auto digits = number_digits(it, end, buf, spill);
+        it = end;
+
+        int64_t val = 0;
+        check_conversion(std::from_chars(digits.data(), digits.data() + digits.size(), val, base),
+                         digits);
+        return val;
+    }
+
+    double read_float(iterator &it,
+                      const iterator &end)
+    {
+        char buf[96];
+        std::string spill;
+        auto digits = number_digits(it, end, buf, spill);
+        it = end;
+
+        double val = 0;
+#if defined(__cpp_lib_to_chars)
+        check_conversion(std::from_chars(digits.data(), digits.data() + digits.size(), val),
+                         digits);
+#else
+        // no floating point std::from_chars: use a stream pinned to the
+        // classic locale so the decimal point is always '.'
+        std::istringstream ss{std::string{digits}};
+        ss.imbue(std::locale::classic());
+        if (!(ss >> val) || ss.peek() != std::char_traits<char>::eof())
+            throw_parse_exception("Malformed number (invalid argument)");
+#endif
+        return val;
+    }
+
+    void parse_bool(iterator &it,
+                    const iterator &end)
+    {
+        auto pos = position(it);
+        auto eat = consumer(it, end, [&]()
+                            { throw_parse_exception("attempt to parse invalid boolean value"); });
+
+        if (*it == 't')
+        {
+            eat("true");
+            handler_.on_value(true, pos);
+        }
+        else if (*it == 'f')
+        {
+            eat("false");
+            handler_.on_value(false, pos);
+        }
+        else
+        {
+            // should be unreachable
+            throw_parse_exception("attempt to parse invalid boolean value: " +
+                                  std::string{it, end});
+        }
+    }
+
+    iterator find_end_of_number(iterator it,
+                                iterator end)
+    {
+        auto ret = detail::skip_class(it, end, detail::cc_number);
+        if (ret != end && ret + 1 != end && ret + 2 != end)
+        {
+            if ((ret[0] == 'i' && ret[1] == 'n' && ret[2] == 'f') ||
+                (ret[0] == 'n' && ret[1] == 'a' && ret[2] == 'n'))
+            {
+                ret = ret + 3;
+            }
+        }
+        return ret;
+    }
+
+    iterator find_end_of_date(iterator it,
+                              iterator end)
+    {
+        auto end_of_date = detail::skip_class(it, end, detail::cc_full_date);
+
+        if (end_of_date != end && *end_of_date == ' ' && end_of_date + 1 != end &&
+            std::isdigit(static_cast<unsigned char>(end_of_date[1])))
+        {
+            end_of_date++;
+        }
+
+        return detail::skip_class(end_of_date, end, detail::cc_date);
+    }
+
+    iterator find_end_of_time(iterator it,
+                              iterator end)
+    {
+        return detail::skip_class(it, end, detail::cc_time);
+    }
+
+    local_time read_time(iterator &it,
+                         const iterator &end)
+    {
+        auto time_end = find_end_of_time(it, end);
+
+        auto eat = consumer(it, time_end, [&]()
+                            { throw_parse_exception("Malformed time"); });
+
+        local_time ltime;
+
+        ltime.hour = eat.eat_digits(2);
+        eat(':');
+        ltime.minute = eat.eat_digits(2);
+        eat(':');
+        ltime.second = eat.eat_digits(2);
+
+        int power = 100000;
+        if (it != time_end && *it == '.')
+        {
+            ++it;
+            while (it != time_end && std::isdigit(static_cast<unsigned char>(*it)))
+            {
+                ltime.nanosecond += power * (*it++ - '0') * 1000;
+                power /= 10;
+            }
+        }
+
+        if (it != time_end)
+            throw_parse_exception("Malformed time");
+
+        return ltime;
+    }
+
+    void parse_time(iterator &it, const iterator &end)
+    {
+        auto pos = position(it);
+        handler_.on_value(read_time(it, end), pos);
+    }
+
+    void parse_date(iterator &it,
+                    const iterator &end)
+    {
+        auto pos = position(it);
+        auto date_end = find_end_of_date(it, end);
+
+        auto eat = consumer(it, date_end, [&]()
+                            { throw_parse_exception("Malformed date"); });
+
+        local_date ldate;
+        ldate.year = eat.eat_digits(4);
+        eat('-');
+        ldate.month = eat.eat_digits(2);
+        eat('-');
+        ldate.day = eat.eat_digits(2);
+
+        if (it == date_end)
+        {
+            handler_.on_value(std::move(ldate), pos);
+            return;
+        }
+
+        eat.eat_either('T', ' ');
+
+        local_date_time ldt(std::move(ldate), read_time(it, date_end));
+
+        if (it == date_end)
+        {
+            handler_.on_value(std::move(ldt), pos);
+            return;
+        }
+
+        offset_date_time dt;
+        static_cast<local_date_time &>(dt) = ldt;
+
+        int hoff = 0;
+        int moff = 0;
+        if (*it == '+' || *it == '-')
+        {
+            auto plus = *it == '+';
+            ++it;
+
+            hoff = eat.eat_digits(2);
+            eat(':');
+            moff = eat.eat_digits(2);
+
+            static_cast<time_offset &>(dt) = time_offset((plus) ? hoff : -hoff,
+                                                         (plus) ? moff : -moff);
+        }
+        else if (*it == 'Z')
+        {
+            ++it;
+        }
+
+        if (it != date_end)
+            throw_parse_exception("Malformed date");
+
+        handler_.on_value(std::move(dt), pos);
+    }
+
+    void parse_array(iterator &it,
+                     iterator &end)
+    {
+        // toml v1.0.0-rc.1 removed the "homogeneity" restriction:
+        // arrays can either be homogeneous, or contain mixed types
+
+        handler_.on_array_begin(position(it));
+
+        ++it;
+        skip_whitespace_and_comments(it, end);
+
+        while (it != end && *it != ']')
+        {
+            skip_whitespace_and_comments(it, end);
+            parse_value(it, end);
+            skip_whitespace_and_comments(it, end);
+            if (*it != ',')
+                break;
+            ++it;
+            skip_whitespace_and_comments(it, end);
+        }
+
+        if (it == end)
+        {
+            throw_parse_exception("missing closing `]` in array");
+        }
+        else
+        {
+            handler_.on_array_end(position(it));
+            ++it;
+        }
+    }
+
+    void parse_inline_table(iterator &it,
+                            iterator &end)
+    {
+        handler_.on_inline_table_begin(position(it));
+        do
+        {
+            ++it;
+            if (it == end)
+                throw_parse_exception("Unterminated inline table");
+
+            consume_whitespace(it, end);
+            if (it != end && *it != '}')
+            {
+                parse_key_value(it, end);
+                consume_whitespace(it, end);
+            }
+        } while (it != end && *it == ',');
+
+        if (it == end || *it != '}')
+            throw_parse_exception("Unterminated inline table");
+
+        handler_.on_inline_table_end(position(it));
+        ++it;
+        consume_whitespace(it, end);
+    }
+
+    void skip_whitespace_and_comments(iterator &start,
+                                      iterator &end)
+    {
+        consume_whitespace(start, end);
+        while (start == end || *start == '#')
+        {
+            if (!next_line(start, end))
+                throw_parse_exception("Unclosed array");
+            consume_whitespace(start, end);
+        }
+    }
+
+    void consume_whitespace(iterator &it,
+                            const iterator &end)
+    {
+        it = detail::skip_whitespace(it, end);
+    }
+
+    void consume_backwards_whitespace(iterator &back,
+                                      const iterator &front)
+    {
+        while (back != front && (*back == ' ' || *back == '\t'))
+            --back;
+    }
+
+    void eol_or_comment(const iterator &it,
+                        const iterator &end)
+    {
+        if (it != end && *it != '#')
+            throw_parse_exception("Unidentified trailing character '" + std::string{*it} + "'---did you forget a '#'?");
+    }
+
+    bool is_time(const iterator &it,
+                 const iterator &end)
+    {
+        auto time_end = find_end_of_time(it, end);
+        auto len = std::distance(it, time_end);
+
+        if (len < 8)
+            return false;
+
+        if (it[2] != ':' || it[5] != ':')
+            return false;
+
+        if (len > 8)
+            return it[8] == '.' && len > 9;
+
+        return true;
+    }
+
+    numeric_type determine_date_type(const iterator &it,
+                                     const iterator &end)
+    {
+        auto date_end = find_end_of_date(it, end);
+        auto len = std::distance(it, date_end);
+
+        if (len < 10)
+            return numeric_type::None;
+        ;
+
+        if (it[4] != '-' || it[7] != '-')
+            return numeric_type::None;
+
+        if (len >= 19 && (it[10] == 'T' || it[10] == ' ') && is_time(it + 11, date_end))
+        {
+            // datetime type
+            auto time_end = find_end_of_time(it + 11, date_end);
+            if (time_end == date_end)
+                return {numeric_type::LocalDateTime};
+            else
+                return {numeric_type::OffsetDateTime};
+        }
+        else if (len == 10)
+        {
+            // just a regular date
+            return {numeric_type::LocalDate};
+        }
+
+        return {};
+    }
+
+    Handler &handler_;
+    std::vector<std::string> key_parts_;
+    size_t key_size_{0};
+    std::string string_;
+    iterator cursor_;
+    iterator source_end_;
+    iterator line_begin_;
+    std::size_t line_number_;
+};
+
+namespace detail
+{
+struct string_capture : event_handler
+{
+    using event_handler::on_value;
+
+    std::string value;
+
+    void on_value(std::string &&val, const source_position &)
+    {
+        value = std::move(val);
+    }
+};
+} // namespace detail
+
+/**
+ * Decodes a string value from its source form, see
+ * event_handler::on_raw_string().
+ * @throw parse_error if the string is malformed
+ */
+inline std::string decode_string(std::string_view source)
+{
+    detail::string_capture capture;
+    event_parser<detail::string_capture>{source, capture}.parse_value();
+    return std::move(capture.value);
+}
+
+/**
+ * Parses a buffer into events passed to handler.
+ * @return the error that stopped the parse, if any
+ */
+template <class Handler>
+std::optional<parse_error> parse_events(std::string_view source, Handler &handler)
+{
+    try
+    {
+        event_parser<Handler>{source, handler}.parse();
+        return std::nullopt;
+    }
+    catch (const parse_error &e)
+    {
+        return e;
+    }
+}
+
+/**
+ * Parses a file into events passed to handler, see parse_file().
+ * @return the error that stopped the parse, if any
+ */
+template <class Handler>
+std::optional<parse_error> parse_file_events(const std::string &file_path, Handler &handler)
+{
+    mapped_file file{file_path};
+
+    if (!file.is_open())
+    {
+        return parse_error(file_path + " could not be opened for parsing");
+    }
+    return parse_events(file.view(), handler);
+}
+TOML_NAMESPACE_END
+} // namespace toml
@@ -0,0 +1,347 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <mutex>
+#include <ostream>
+#include <unordered_map>
+
+#include "base.h"
+
+namespace toml
+{
+TOML_NAMESPACE_BEGIN
+
+namespace detail
+{
+inline size_t hash_key(std::string_view text) noexcept
+{
+    return std::hash<std::string_view>{}(text);
+}
+
+/**
+ * Shared key storage: a header followed by the null-terminated text, in a
+ * single allocation.
+ */
+struct key_rep
+{
+    std::atomic<uint32_t> refs{1};
+    uint32_t size{0};
+    uint64_t pool{0}; // id of the pool that interned it, 0 if none
+    size_t hash{0};
+    bool immortal{false};
+    char text[1];
+
+    static key_rep *create(std::string_view text, uint64_t pool, bool immortal)
+    {
+        auto memory = ::operator new(offsetof(key_rep, text) + text.size() + 1);
+        auto rep = new (memory) key_rep;
+        rep->size = static_cast<uint32_t>(text.size());
+        rep->pool = pool;
+        rep->hash = hash_key(text);
+        rep->immortal = immortal;
+        std::memcpy(rep->text, text.data(), text.size());
+        rep->text[text.size()] = '\0';
+        return rep;
+    }
+
+    static void destroy(key_rep *rep) noexcept
+    {
+        rep->~key_rep();
+        ::operator delete(rep);
+    }
+};
+} // namespace detail
+
+/**
+ * An immutable, reference-counted table key.
+ *
+ * Keys carry their hash, and keys interned in the same key_pool share one
+ * buffer, so two of them are equal exactly when they point to the same
+ * buffer. A key converts to std::string_view and std::string, so it can be
+ * used wherever the std::string keys of earlier versions were.
+ */
+class key
+{
+    friend class key_pool;
+
+public:
+    key() noexcept = default;
+
+    /**
+     * Creates a key that is not interned.
+     */
+    explicit key(std::string_view text)
+        : rep_(detail::key_rep::create(text, 0, false)) {}
+
+    key(const key &other) noexcept
+        : rep_(other.rep_)
+    {
+        retain();
+    }
+
+    key(key &&other) noexcept
+        : rep_(other.rep_)
+    {
+        other.rep_ = nullptr;
+    }
+
+    key &operator=(const key &other) noexcept
+    {
+        if (rep_ != other.rep_)
+        {
+            release();
+            rep_ = other.rep_;
+            retain();
+        }
+        return *this;
+    }
+
+    key &operator=(key &&other) noexcept
+    {
+        if (this != &other)
+        {
+            release();
+            rep_ = other.rep_;
+            other.rep_ = nullptr;
+        }
+        return *this;
+    }
+
+    ~key()
+    {
+        release();
+    }
+
+    std::string str() const
+    {
+        return std::string{view()};
+    }
+
+    std::string_view view() const noexcept
+    {
+        return rep_ ? std::string_view{rep_->text, rep_->size} : std::string_view{};
+    }
+
+    operator std::string_view() const noexcept
+    {
+        return view();
+    }
+
+    operator std::string() const
+    {
+        return str();
+    }
+
+    const char *data() const noexcept
+    {
+        return rep_ ? rep_->text : "";
+    }
+
+    const char *c_str() const noexcept
+    {
+        return data();
+    }
+
+    size_t size() const noexcept
+    {
+        return rep_ ? rep_->size : 0;
+    }
+
+    bool empty() const noexcept
+    {
+        return size() == 0;
+    }
+
+    size_t hash() const noexcept
+    {
+        return rep_ ? rep_->hash : detail::hash_key({});
+    }
+
+    bool is_interned() const noexcept
+    {
+        return rep_ && rep_->pool != 0;
+    }
+
+    friend bool operator==(const key &lhs, const key &rhs) noexcept
+    {
+        if (lhs.rep_ == rhs.rep_)
+        {
+            return true;
+        }
+        // distinct buffers from the same pool hold distinct text
+        if (lhs.is_interned() && rhs.is_interned() && lhs.rep_->pool == rhs.rep_->pool)
+        {
+            return false;
+        }
+        return lhs.hash() == rhs.hash() && lhs.view() == rhs.view();
+    }
+
+    friend bool operator==(const key &lhs, std::string_view rhs) noexcept
+    {
+        return lhs.view() == rhs;
+    }
+
+    friend bool operator==(std::string_view lhs, const key &rhs) noexcept
+    {
+        return lhs == rhs.view();
+    }
+
+    template <typename T>
+    friend bool operator!=(const key &lhs, const T &rhs) noexcept
+    {
+        return !(lhs == rhs);
+    }
+
+    friend bool operator!=(std::string_view lhs, const key &rhs) noexcept
+    {
+        return !(lhs == rhs);
+    }
+
+    friend bool operator<(const key &lhs, const key &rhs) noexcept
+    {
+        return lhs.view() < rhs.view();
+    }
+
+    friend std::ostream &operator<<(std::ostream &stream, const key &k)
+    {
+        return stream << k.view();
+    }
+
+private:
+    detail::key_rep *rep_{nullptr};
+
+    explicit key(detail::key_rep *rep) noexcept
+        : rep_(rep) {}
+
+    void retain() noexcept
+    {
+        if (rep_ && !rep_->immortal)
+        {
+            rep_->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void release() noexcept
+    {
+        if (rep_ && !rep_->immortal &&
+            rep_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            detail::key_rep::destroy(rep_);
+        }
+        rep_ = nullptr;
+    }
+};
+
+/**
+ * Transparent ordering of keys and anything convertible to string_view.
+ */
+struct key_less
+{
+    using is_transparent = void;
+
+    bool operator()(std::string_view lhs, std::string_view rhs) const noexcept
+    {
+        return lhs < rhs;
+    }
+};
+
+/**
+ * Interns keys, so that equal keys share one buffer.
+ *
+ * The parser uses a pool per document: its keys outlive the pool, which
+ * only exists while the document is being built. A pool may forward
+ * misses to a parent pool such as the process-wide global() one, whose
+ * keys are never freed and are copied without touching a reference count.
+ */
+class key_pool
+{
+public:
+    explicit key_pool(key_pool *parent = nullptr) noexcept
+        : parent_(parent),
+          id_(next_id()) {}
+
+    key_pool(const key_pool &) = delete;
+    key_pool &operator=(const key_pool &) = delete;
+
+    /**
+     * The process-wide pool. It is safe to use from several threads.
+     */
+    static key_pool &global()
+    {
+        // never destroyed: its keys may be held by other static objects
+        static key_pool *pool = new key_pool{nullptr, true};
+        return *pool;
+    }
+
+    key intern(std::string_view text)
+    {
+        if (immortal_)
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            return lookup(text);
+        }
+        return lookup(text);
+    }
+
+    size_t size() const noexcept
+    {
+        return keys_.size();
+    }
+
+private:
+    std::unordered_map<std::string_view, key> keys_;
+    key_pool *parent_{nullptr};
+    uint64_t id_;
+    bool immortal_{false};
+    std::mutex mutex_;
+
+    key_pool(key_pool *parent, bool immortal) noexcept
+        : parent_(parent),
+          id_(next_id()),
+          immortal_(immortal) {}
+
+    static uint64_t next_id() noexcept
+    {
+        static std::atomic<uint64_t> counter{0};
+        return ++counter;
+    }
+
+    key lookup(std::string_view text)
+    {
+        if (auto it = keys_.find(text); it != keys_.end())
+        {
+            return it->second;
+        }
+
+        key result;
+        if (parent_)
+        {
+            result = parent_->intern(text);
+        }
+        else
+        {
+            result = key{detail::key_rep::create(text, id_, immortal_)};
+        }
+        keys_.emplace(result.view(), result);
+        return result;
+    }
+};
+
+TOML_NAMESPACE_END
+} // namespace toml
+
+namespace std
+{
+template <>
+struct hash<toml::key>
+{
+    size_t operator()(const toml::key &k) const noexcept
+    {
+        return k.hash();
+    }
+};
+} // namespace std
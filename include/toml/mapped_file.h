@@ -0,0 +1,216 @@
+#pragma once
+
+#include <cerrno>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <string_view>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define TOML_HAS_MMAP 1
+#else
+#define TOML_HAS_MMAP 0
+#endif
+
+#include "base.h"
+
+namespace toml
+{
+TOML_NAMESPACE_BEGIN
+
+/**
+ * Read-only contents of a file held in one contiguous buffer.
+ *
+ * Regular files are memory-mapped so the parser reads straight out of the
+ * page cache. Anything that cannot be mapped (pipes, character devices,
+ * files under /proc reporting a size of zero) is read into a single owned
+ * buffer instead. Like std::ifstream, failure to open is reported through
+ * is_open() rather than by throwing.
+ */
+class mapped_file
+{
+public:
+    mapped_file() noexcept = default;
+
+    explicit mapped_file(const std::string &file_path)
+    {
+        open(file_path);
+    }
+
+    mapped_file(mapped_file &&other) noexcept
+        : data_(other.data_),
+          size_(other.size_),
+          mapped_(other.mapped_),
+          is_open_(other.is_open_),
+          buffer_(std::move(other.buffer_))
+    {
+        if (!mapped_)
+        {
+            data_ = buffer_.data();
+        }
+        other.reset();
+    }
+
+    mapped_file &operator=(mapped_file &&other) noexcept
+    {
+        if (this != &other)
+        {
+            close();
+            data_ = other.data_;
+            size_ = other.size_;
+            mapped_ = other.mapped_;
+            is_open_ = other.is_open_;
+            buffer_ = std::move(other.buffer_);
+            if (!mapped_)
+            {
+                data_ = buffer_.data();
+            }
+            other.reset();
+        }
+        return *this;
+    }
+
+    mapped_file(const mapped_file &) = delete;
+    mapped_file &operator=(const mapped_file &) = delete;
+
+    ~mapped_file()
+    {
+        close();
+    }
+
+    bool is_open() const noexcept
+    {
+        return is_open_;
+    }
+
+    /**
+     * Whether the contents are served from a memory mapping rather than
+     * the fallback buffer.
+     */
+    bool is_mapped() const noexcept
+    {
+        return mapped_;
+    }
+
+    const char *data() const noexcept
+    {
+        return data_;
+    }
+
+    size_t size() const noexcept
+    {
+        return size_;
+    }
+
+    std::string_view view() const noexcept
+    {
+        return {data_, size_};
+    }
+
+    void close() noexcept
+    {
+#if TOML_HAS_MMAP
+        if (mapped_)
+        {
+            ::munmap(const_cast<char *>(data_), size_);
+        }
+#endif
+        reset();
+    }
+
+private:
+    const char *data_{nullptr};
+    size_t size_{0};
+    bool mapped_{false};
+    bool is_open_{false};
+    std::string buffer_;
+
+    void reset() noexcept
+    {
+        data_ = nullptr;
+        size_ = 0;
+        mapped_ = false;
+        is_open_ = false;
+        buffer_.clear();
+    }
+
+#if TOML_HAS_MMAP
+    void open(const std::string &file_path)
+    {
+        int fd = ::open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            return;
+        }
+
+        struct stat st;
+        if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+        {
+            auto size = static_cast<size_t>(st.st_size);
+            void *addr = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr != MAP_FAILED)
+            {
+#ifdef MADV_SEQUENTIAL
+                ::madvise(addr, size, MADV_SEQUENTIAL);
+#endif
+                data_ = static_cast<const char *>(addr);
+                size_ = size;
+                mapped_ = true;
+                is_open_ = true;
+                ::close(fd);
+                return;
+            }
+        }
+
+        // not mappable: slurp whatever the descriptor yields
+        is_open_ = read_all(fd);
+        data_ = buffer_.data();
+        size_ = buffer_.size();
+        ::close(fd);
+    }
+
+    bool read_all(int fd)
+    {
+        constexpr size_t chunk = 64 * 1024;
+        size_t used = 0;
+        while (true)
+        {
+            buffer_.resize(used + chunk);
+            auto n = ::read(fd, buffer_.data() + used, chunk);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                buffer_.clear();
+                return false;
+            }
+            if (n == 0)
+                break;
+            used += static_cast<size_t>(n);
+        }
+        buffer_.resize(used);
+        return true;
+    }
+#else
+    void open(const std::string &file_path)
+    {
+        std::ifstream file{file_path, std::ios::binary};
+        if (!file.is_open())
+        {
+            return;
+        }
+
+        buffer_.assign(std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{});
+        data_ = buffer_.data();
+        size_ = buffer_.size();
+        is_open_ = true;
+    }
+#endif
+};
+
+TOML_NAMESPACE_END
+} // namespace toml
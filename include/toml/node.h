@@ -167,6 +167,16 @@ protected:
     node(base_type t)
         : type_(t) {}
 
+    /**
+     * Decodes a value kept in its source form; see value<T>::get().
+     */
+    virtual void decode() const
+    {
+    }
+
+    /// Whether decode() must be called before reading the value.
+    bool lazy_{false};
+
 private:
     base_type type_{base_type::None};
 
@@ -0,0 +1,463 @@
+#pragma once
+
+#include "node.h"
+#include "value.h"
+#include "array.h"
+#include "table.h"
+#include "document.h"
+
+namespace toml
+{
+TOML_NAMESPACE_BEGIN
+
+/**
+ * A borrowed handle to a value of a document: the same lookup and access
+ * API as node_view, over a raw pointer.
+ *
+ * Copying a node_ref or stepping through it with operator[] touches no
+ * reference count, so threads can walk a shared document without
+ * contending on its control blocks. A node_ref does not keep the document
+ * alive: hold the node_view (or parse_result) of its root for as long as
+ * refs into it are in use, and call view() to get an owning handle.
+ */
+class node_ref final
+{
+    friend class node_view;
+    friend class document;
+    friend class snapshot;
+
+public:
+    node_ref() noexcept = default;
+
+    node_ref(const node &n) noexcept
+        : node_(&n) {}
+
+    explicit operator bool() const noexcept
+    {
+        return node_ != nullptr || slot_ != nullptr;
+    }
+
+    /**
+     * Whether this refers into a compact document rather than a node tree.
+     */
+    bool is_compact() const noexcept
+    {
+        return slot_ != nullptr;
+    }
+
+    base_type type() const noexcept
+    {
+        if (node_)
+        {
+            return node_->type();
+        }
+        return slot_ ? slot_->type : base_type::None;
+    }
+
+    /**
+     * The referenced node. Only valid for refs into a node tree.
+     */
+    const node &get() const noexcept
+    {
+        return *node_;
+    }
+
+    /**
+     * An owning view of the same value.
+     */
+    inline node_view view() const noexcept; // implemented in node_view.h
+
+    template <typename T>
+    bool is() const noexcept
+    {
+        if (node_)
+        {
+            return node_->template is<T>();
+        }
+        else if constexpr (std::is_same_v<T, array>)
+        {
+            return slot_ && (slot_->type == base_type::Array || slot_->type == base_type::TableArray);
+        }
+        else
+        {
+            return slot_ && slot_->type == value_type_traits<T>::value;
+        }
+    }
+
+    bool is_value() const noexcept
+    {
+        auto t = static_cast<uint8_t>(type());
+        return t > 0 && t < 9;
+    }
+
+    bool is_table() const noexcept
+    {
+        return is<table>();
+    };
+
+    bool is_array() const noexcept
+    {
+        return is<array>();
+    }
+
+    bool is_table_array() const noexcept
+    {
+        return node_ ? node_->is_table_array() : slot_ && slot_->type == base_type::TableArray;
+    }
+
+    bool contains(std::string_view key) const
+    {
+        auto position = key.find('.');
+        if (position != std::string_view::npos && position + 1 < key.size())
+        {
+            return (*this)[key.substr(0, position)].contains(key.substr(position + 1));
+        }
+        else
+        {
+            return bool((*this)[key.substr(0, position)]);
+        }
+    }
+
+    /**
+     * Whether the document has a value at a pre-split path.
+     */
+    inline bool contains(const path &p) const; // implemented in path.h
+
+    template <class T>
+    auto as() const
+    {
+        using return_type = decltype(std::declval<node &>().template as<T>());
+        if (node_)
+        {
+            return const_cast<node *>(node_)->template as<T>();
+        }
+        else if (!slot_)
+        {
+            return return_type{};
+        }
+        else if constexpr (is_one_of_v<std::remove_cv_t<T>, array, table>)
+        {
+            if (!is<std::remove_cv_t<T>>())
+            {
+                throw std::runtime_error("cannot convert toml::node to array or table");
+            }
+            return return_type{std::static_pointer_cast<std::remove_cv_t<T>>(materialize())};
+        }
+        else
+        {
+            return return_type{get<T>().value()};
+        }
+    }
+
+    template <typename T, typename U = typename value_type_traits<std::decay_t<T>>::type>
+    auto as(T &&default_value) const noexcept
+    {
+        if (node_)
+        {
+            return node_->as(std::forward<T>(default_value));
+        }
+        else if (slot_)
+        {
+            if (auto val = doc_->template value<U>(*slot_))
+            {
+                return *val;
+            }
+        }
+        return U{std::forward<T>(default_value)};
+    }
+
+    template <class T>
+    auto get() const
+    {
+        using return_type = decltype(std::declval<const node &>().template get<T>());
+        if (node_)
+        {
+            return node_->template get<T>();
+        }
+        else if (!slot_)
+        {
+            return return_type{};
+        }
+        else if constexpr (is_one_of_v<std::remove_cv_t<T>, array, table>)
+        {
+            return is<std::remove_cv_t<T>>()
+                       ? return_type{std::static_pointer_cast<std::add_const_t<T>>(materialize())}
+                       : return_type{};
+        }
+        else
+        {
+            return doc_->template value<typename value_type_traits<std::decay_t<T>>::type>(*slot_);
+        }
+    }
+
+    node_ref operator[](std::string_view key) const
+    {
+        node_ref result;
+        auto position = key.find('.');
+
+        if (slot_)
+        {
+            if (slot_->type == base_type::Table)
+            {
+                result = child(doc_->find(*slot_, key.substr(0, position)));
+            }
+        }
+        else if (node_ && node_->is<table>())
+        {
+            const auto &tbl = static_cast<const table &>(*node_);
+            if (auto it = tbl.find(key.substr(0, position)); it != tbl.end())
+            {
+                result = node_ref{*it->second};
+            }
+        }
+
+        if (position != std::string_view::npos && position + 1 < key.size())
+        {
+            return result[key.substr(position + 1)];
+        }
+        else
+        {
+            return result;
+        }
+    }
+
+    node_ref operator[](size_t index) const
+    {
+        if (slot_)
+        {
+            return is<array>() ? child(doc_->at(*slot_, index)) : node_ref{};
+        }
+        else if (node_ && node_->is<array>())
+        {
+            const auto &elements = static_cast<const array &>(*node_).get();
+            return index < elements.size() ? node_ref{*elements[index]} : node_ref{};
+        }
+        else
+        {
+            return {};
+        }
+    }
+
+    /**
+     * Looks up a pre-split path, see toml::path.
+     */
+    inline node_ref operator[](const path &p) const; // implemented in path.h
+
+    template <typename T, typename F, typename U = std::invoke_result_t<F, const T &>,
+              typename = std::enable_if_t<!std::is_void_v<U>>>
+    std::optional<U> map(F &&f) const
+    {
+        if (!*this)
+        {
+            return std::nullopt;
+        }
+        else if constexpr (std::is_same_v<T, node_ref>)
+        {
+            return {f(*this)};
+        }
+        else if constexpr (std::is_same_v<T, node_view>)
+        {
+            return {f(view())};
+        }
+        else if (const auto val = this->template get<T>())
+        {
+            return {f(*val)};
+        }
+        else
+        {
+            return std::nullopt;
+        }
+    }
+
+    template <typename T, typename F, typename U = std::invoke_result_t<F, const T &>,
+              typename = std::enable_if_t<std::is_void_v<U>>>
+    void map(F &&f) const
+    {
+        if (!*this)
+        {
+            return;
+        }
+        else if constexpr (std::is_same_v<T, node_ref>)
+        {
+            f(*this);
+        }
+        else if constexpr (std::is_same_v<T, node_view>)
+        {
+            f(view());
+        }
+        else if (const auto val = this->template get<T>())
+        {
+            f(*val);
+        }
+    }
+
+    template <typename T, typename U = typename value_type_traits<T>::type>
+    std::vector<U> collect() const
+    {
+        if constexpr (is_value_promotable<std::decay_t<T>>)
+        {
+            // reads packed arrays without going through element nodes
+            if (node_ && node_->is<array>())
+                return static_cast<const array &>(*node_).template collect<T>();
+        }
+
+        std::vector<U> result;
+        for_each_element(
+            [&](const node_ref &element)
+            {
+                if constexpr (std::is_same_v<T, node_ref>)
+                {
+                    result.emplace_back(element);
+                }
+                else if constexpr (std::is_same_v<T, node_view>)
+                {
+                    result.emplace_back(element.view());
+                }
+                else if constexpr (is_one_of_v<T, array, table>)
+                {
+                    if (element.template is<T>())
+                    {
+                        result.emplace_back(element.template as<T>());
+                    }
+                }
+                else if constexpr (is_value_promotable<std::decay_t<T>>)
+                {
+                    if (const auto val = element.template get<U>())
+                    {
+                        result.emplace_back(val.value());
+                    }
+                }
+            });
+        return result;
+    }
+
+    template <typename T, typename F, typename U = std::invoke_result_t<F, const T &>,
+              typename = std::enable_if_t<!std::is_void_v<U>>>
+    std::vector<U> map_collect(F &&f) const
+    {
+        if constexpr (is_value_promotable<std::decay_t<T>>)
+        {
+            if (node_ && node_->is<array>())
+                return static_cast<const array &>(*node_).template map_collect<T>(std::forward<F>(f));
+        }
+
+        std::vector<U> result;
+        for_each_element(
+            [&](const node_ref &element)
+            {
+                if (const auto val = element.template map<T>(f))
+                {
+                    result.emplace_back(val.value());
+                }
+            });
+        return result;
+    }
+
+    /**
+     * Calls f(node_ref) for each element of an array; does nothing for
+     * anything else.
+     */
+    template <class F>
+    void for_each_element(F &&f) const
+    {
+        if (slot_)
+        {
+            if (is<array>())
+            {
+                for (auto it = doc_->children_begin(*slot_); it != doc_->children_end(*slot_); ++it)
+                {
+                    f(node_ref{*doc_, *it});
+                }
+            }
+        }
+        else if (node_ && node_->is<array>())
+        {
+            for (const auto &element : static_cast<const array &>(*node_))
+            {
+                f(node_ref{*element});
+            }
+        }
+    }
+
+    /**
+     * Calls f(std::string_view key, node_ref) for each entry of a table;
+     * does nothing for anything else.
+     */
+    template <class F>
+    void for_each_entry(F &&f) const
+    {
+        if (slot_)
+        {
+            if (is<table>())
+            {
+                for (auto it = doc_->children_begin(*slot_); it != doc_->children_end(*slot_); ++it)
+                {
+                    f(doc_->key(*it), node_ref{*doc_, *it});
+                }
+            }
+        }
+        else if (node_ && node_->is<table>())
+        {
+            for (const auto &[key, child] : static_cast<const table &>(*node_))
+            {
+                f(key.view(), node_ref{*child});
+            }
+        }
+    }
+
+    /**
+     * The elements of a packed array without copying, see array::as_span().
+     * Empty for anything else, including arrays of compact documents.
+     */
+    template <typename T>
+    span<const T> as_span() const noexcept
+    {
+        if (node_ && node_->is<array>())
+        {
+            return static_cast<const array &>(*node_).template as_span<T>();
+        }
+        return {};
+    }
+
+    /**
+     * Visits the referenced node. Parts of a compact document are first
+     * copied into a node tree.
+     */
+    template <class Visitor, class... Args>
+    void accept(Visitor &&visitor, Args &&...args) const
+    {
+        if (node_)
+        {
+            return node_->accept(std::forward<Visitor>(visitor), std::forward<Args>(args)...);
+        }
+        else if (slot_)
+        {
+            return materialize()->accept(std::forward<Visitor>(visitor), std::forward<Args>(args)...);
+        }
+    }
+
+private:
+    const node *node_{nullptr};
+    const document *doc_{nullptr};
+    const document::slot *slot_{nullptr};
+
+    node_ref(const document &doc, const document::slot &s) noexcept
+        : doc_(&doc),
+          slot_(&s) {}
+
+    node_ref child(const document::slot *s) const noexcept
+    {
+        return s ? node_ref{*doc_, *s} : node_ref{};
+    }
+
+    std::shared_ptr<node> materialize() const
+    {
+        return doc_->materialize(*slot_);
+    }
+
+    inline const node *find_node(const path &p) const noexcept;
+    inline const document::slot *find_slot(const path &p) const noexcept;
+};
+
+TOML_NAMESPACE_END
+} // namespace toml
@@ -4,13 +4,27 @@
 #include "value.h"
 #include "array.h"
 #include "table.h"
+#include "document.h"
+#include "node_ref.h"
 
 namespace toml
 {
 TOML_NAMESPACE_BEGIN
 
+/**
+ * A shared handle to a value of a parsed document, which may be a node tree
+ * or a compact document. Navigation and value access work the same way over
+ * both; only get() and as_value() need a node tree, and tables or arrays
+ * requested from a compact document by as<T>() or get<T>() are detached
+ * copies. Each view keeps its document alive; see node_ref for a handle
+ * that does not.
+ */
 class node_view final
 {
+    friend class document;
+    friend class node_ref;
+    friend class snapshot;
+
 public:
     node_view() noexcept = default;
 
@@ -19,14 +33,38 @@ public:
 
     explicit operator bool() const noexcept
     {
-        return node_ != nullptr;
+        return node_ != nullptr || slot_ != nullptr;
+    }
+
+    /**
+     * A borrowed handle to the same value, valid while this view (or any
+     * other view of the document) is alive.
+     */
+    node_ref ref() const noexcept
+    {
+        if (node_)
+        {
+            return node_ref{*node_};
+        }
+        return slot_ ? node_ref{*doc_, *slot_} : node_ref{};
+    }
+
+    /**
+     * Whether this is a view into a compact document rather than a node tree.
+     */
+    bool is_compact() const noexcept
+    {
+        return slot_ != nullptr;
     }
 
     base_type type() const noexcept
     {
-        return node_ ? node_->type() : base_type::None;
+        return ref().type();
     }
 
+    /**
+     * The viewed node. Only valid for views into a node tree.
+     */
     const node &get() const noexcept
     {
         return *node_;
@@ -35,40 +73,40 @@ public:
     template <typename T>
     bool is() const noexcept
     {
-        return node_ && node_->template is<T>();
+        return ref().template is<T>();
     }
 
     bool is_value() const noexcept
     {
-        return node_ && node_->is_value();
+        return ref().is_value();
     }
 
     bool is_table() const noexcept
     {
-        return node_ && node_->is<table>();
+        return ref().is_table();
     };
 
     bool is_array() const noexcept
     {
-        return node_ && node_->is<array>();
+        return ref().is_array();
     }
 
     bool is_table_array() const noexcept
     {
-        return node_ && node_->is_table_array();
+        return ref().is_table_array();
     }
 
     bool contains(std::string_view key) const
     {
-        auto position = key.find('.');
-        if (position != std::string_view::npos && position + 1 < key.size())
-        {
-            return (*this)[key.substr(0, position)].contains(key.substr(position + 1));
-        }
-        else
-        {
-            return bool((*this)[key.substr(0, position)]);
-        }
+        return ref().contains(key);
+    }
+
+    /**
+     * Whether the document has a value at a pre-split path.
+     */
+    bool contains(const path &p) const
+    {
+        return ref().contains(p);
     }
 
     template <class T>
@@ -80,113 +118,111 @@ public:
     template <class T>
     auto as() const
     {
-        using return_type = decltype(node_->template as<T>());
-        return node_ ? node_->as<T>() : return_type{};
+        return ref().template as<T>();
     }
 
     template <typename T>
     auto as(T &&default_value) const noexcept
     {
-        using return_type = decltype(node_->as(std::forward<T>(default_value)));
-        return node_
-                   ? node_->as(std::forward<T>(default_value))
-                   : return_type{std::forward<T>(default_value)};
+        return ref().as(std::forward<T>(default_value));
     }
 
     template <class T>
     auto get() const
     {
-        using return_type = decltype(node_->template get<T>());
-        return node_ ? node_->get<T>() : return_type{};
+        return ref().template get<T>();
     }
 
     node_view operator[](std::string_view key) const
     {
-        node_view result{nullptr};
-        auto position = key.find('.');
-
-        if (auto tbl = this->as<table>())
-        {
-            result = node_view(tbl->at(key.substr(0, position)));
-        }
-
-        if (position != std::string_view::npos && position + 1 < key.size())
-        {
-            return result[key.substr(position + 1)];
-        }
-        else
-        {
-            return result;
-        }
+        return ref()[key].view();
     }
 
     node_view operator[](size_t index) const
     {
-        if (auto arr = this->as<array>())
-        {
-            return {(*arr)[index]};
-        }
-        else
-        {
-            return {nullptr};
-        }
+        return ref()[index].view();
+    }
+
+    /**
+     * Looks up a pre-split path, see toml::path.
+     */
+    node_view operator[](const path &p) const
+    {
+        return ref()[p].view();
     }
 
     template <typename T, typename F, typename U = std::invoke_result_t<F, const T &>,
               typename = std::enable_if_t<!std::is_void_v<U>>>
     std::optional<U> map(F &&f) const
     {
-        return node_ ? node_->template map<T>(f) : std::nullopt;
+        if constexpr (std::is_same_v<T, node_view>)
+        {
+            return *this ? std::optional<U>{f(*this)} : std::nullopt;
+        }
+        else
+        {
+            return ref().template map<T>(std::forward<F>(f));
+        }
     }
 
     template <typename T, typename F, typename U = std::invoke_result_t<F, const T &>,
               typename = std::enable_if_t<std::is_void_v<U>>>
     void map(F &&f) const
     {
-        if (node_)
+        if constexpr (std::is_same_v<T, node_view>)
+        {
+            if (*this)
+            {
+                f(*this);
+            }
+        }
+        else
         {
-            node_->template map<T>(f);
+            ref().template map<T>(std::forward<F>(f));
         }
     }
 
     template <typename T, typename U = typename value_type_traits<T>::type>
     std::vector<U> collect() const
     {
-        if (auto arr = this->as<array>())
-        {
-            return arr->template collect<T>();
-        }
-        else
-        {
-            return {};
-        }
+        return ref().template collect<T>();
     }
 
     template <typename T, typename F, typename U = std::invoke_result_t<F, const T &>,
               typename = std::enable_if_t<!std::is_void_v<U>>>
     std::vector<U> map_collect(F &&f) const
     {
-        if (auto arr = this->as<array>())
-        {
-            return arr->template map_collect<T>(f);
-        }
-        else
-        {
-            return {};
-        }
+        return ref().template map_collect<T>(std::forward<F>(f));
+    }
+
+    /**
+     * The elements of a packed array without copying, valid while the
+     * document is alive; see array::as_span().
+     */
+    template <typename T>
+    span<const T> as_span() const noexcept
+    {
+        return ref().template as_span<T>();
     }
 
+    /**
+     * Visits the viewed node. Parts of a compact document are first copied
+     * into a node tree.
+     */
     template <class Visitor, class... Args>
     void accept(Visitor &&visitor, Args &&...args) const
     {
-        if (node_)
-        {
-            return node_->accept(std::forward<Visitor>(visitor), std::forward<Args>(args)...);
-        }
+        ref().accept(std::forward<Visitor>(visitor), std::forward<Args>(args)...);
     }
 
 private:
     std::shared_ptr<node> node_;
+    std::shared_ptr<const document> doc_;
+    const document::slot *slot_{nullptr};
+
+    node_view(std::shared_ptr<const document> doc, const document::slot *s) noexcept
+        : doc_(std::move(doc)),
+          slot_(s) {}
 };
 
 node_view node::view() const noexcept
@@ -194,5 +230,19 @@ node_view node::view() const noexcept
     return node_view(std::const_pointer_cast<node>(shared_from_this()));
 }
 
+node_view node_ref::view() const noexcept
+{
+    if (node_)
+    {
+        return node_->view();
+    }
+    return slot_ ? node_view{doc_->shared_from_this(), slot_} : node_view{nullptr};
+}
+
+node_view document::view() const noexcept
+{
+    return node_view{shared_from_this(), &root()};
+}
+
 TOML_NAMESPACE_END
 } // namespace toml
\ No newline at end of file
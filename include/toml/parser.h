@@ -1,53 +1,29 @@
 #pragma once
 
 #include <algorithm>
-#include <cctype>
-#include <fstream>
-#include <functional>
-#include <limits>
+#include <cstring>
+#include <filesystem>
+#include <iterator>
+#include <mutex>
 #include <optional>
 #include <stdexcept>
+#include <unordered_map>
 #include <variant>
+#include <vector>
 
+#include "arena.h"
 #include "base.h"
-#include "date_time.h"
+#include "event_parser.h"
+#include "mapped_file.h"
 #include "table.h"
 #include "node_view.h"
+#include "path.h"
+#include "thread_pool.h"
 
 namespace toml
 {
 TOML_NAMESPACE_BEGIN
 
-struct source_position
-{
-    size_t line;   // The line number starting at 1
-    size_t column; // The column number starting at 1
-};
-
-class parse_error : public std::runtime_error
-{
-public:
-    parse_error(const std::string &desc) noexcept
-        : std::runtime_error{desc.data()} {}
-
-    parse_error(const std::string &desc, size_t line_number) noexcept
-        : std::runtime_error{desc.data()},
-          source_{line_number, 0} {}
-
-    std::string_view description() const noexcept
-    {
-        return std::string_view{what()};
-    }
-
-    const source_position &source() const noexcept
-    {
-        return source_;
-    }
-
-private:
-    source_position source_;
-};
-
 class parse_result
 {
 public:
@@ -104,6 +80,10 @@ public:
         : is_error_{false},
           result_{std::in_place_type<node_view>, tbl} {}
 
+    parse_result(node_view &&view) noexcept
+        : is_error_{false},
+          result_{std::in_place_type<node_view>, std::move(view)} {}
+
     parse_result(const parse_error &err) noexcept
         : is_error_{true},
           result_{std::in_place_type<parse_error>, err} {}
@@ -114,225 +94,371 @@ private:
 };
 
 /**
- * Helper object for consuming expected characters.
+ * Options controlling how a document is parsed and stored.
  */
-class consumer
+struct parse_options
 {
-public:
-    consumer(std::string::iterator &it,
-             const std::string::iterator &end,
-             std::function<void()> on_error)
-        : it_(it),
-          end_(end),
-          on_error_(on_error) {}
-
-    void operator()(char c)
-    {
-        if (it_ == end_ || *it_ != c)
-            on_error_();
-        ++it_;
-    }
+    /**
+     * Allocate the nodes of the document (and the entries of its tables)
+     * from a single arena instead of one heap allocation each. The arena
+     * is freed in one go when the last node of the document goes away.
+     */
+    bool use_arena{false};
 
-    template <std::size_t N>
-    void operator()(const char (&str)[N])
-    {
-        std::for_each(std::begin(str), std::end(str) - 1,
-                      [&](char c)
-                      { (*this)(c); });
-    }
+    /**
+     * Store the parsed document as a compact document (see toml::document)
+     * rather than a node tree. Values are stored inline in their parent
+     * table or array, which needs a fraction of the memory of one node per
+     * value, but the result is read-only.
+     */
+    bool compact{false};
 
-    void eat_either(char a, char b)
-    {
-        if (it_ == end_ || (*it_ != a && *it_ != b))
-            on_error_();
-        ++it_;
-    }
+    /**
+     * How the tables of the document store their entries. Hashed tables
+     * give constant-time lookups and keep the keys in document order.
+     */
+    table_storage tables{table_storage::ordered};
 
-    int eat_digits(int len)
-    {
-        int val = 0;
-        for (int i = 0; i < len; ++i)
-        {
-            if (!std::isdigit(static_cast<unsigned char>(*it_)) || it_ == end_)
-                on_error_();
-            val = 10 * val + (*it_++ - '0');
-        }
-        return val;
-    }
+    /**
+     * Intern keys in the process-wide key_pool::global() instead of a pool
+     * of the document's own, so that equal keys of different documents
+     * share one buffer. Keys interned there are never freed.
+     */
+    bool shared_keys{false};
 
-private:
-    std::string::iterator &it_;
-    const std::string::iterator &end_;
-    std::function<void()> on_error_;
+    /**
+     * The number of threads large documents are parsed on, 0 for one per
+     * hardware thread. The document is split at its top-level [table] and
+     * [[table-array]] headers; the sections are parsed concurrently and
+     * then merged in document order, with the same checks as a parse on a
+     * single thread. Documents too small to split are parsed on the
+     * calling thread.
+     */
+    size_t threads{1};
+
+    /**
+     * The key paths to keep, each with everything below it; empty to keep
+     * the whole document. The rest of the document is checked for syntax
+     * only: none of its nodes, strings or keys are created, and tables
+     * defined twice there go unnoticed. Paths through an array of tables
+     * apply to each of its tables. Arrays on the way to a selected key are
+     * kept with all their elements, so that indices stay valid.
+     * Paths must not contain array indices.
+     */
+    std::vector<path> select;
+
+    /**
+     * Keep string values in their source form and decode each the first
+     * time it is read (once, even if several threads read it). Parsing
+     * still checks that the strings are well-formed. The source is copied
+     * into the document's arena, which this implies, so that it stays
+     * valid as long as the nodes do.
+     */
+    bool lazy{false};
 };
 
-// replacement for std::getline to handle incorrectly line-ended files
-// https://stackoverflow.com/questions/6089231/getting-std-ifstream-to-handle-lf-cr-and-crlf
 namespace detail
 {
-inline std::istream &getline(std::istream &input, std::string &line)
+/**
+ * A string value kept in its source form until it is first read.
+ */
+class lazy_string final : public value<std::string>
 {
-    line.clear();
-
-    std::istream::sentry sentry{input, true};
-    auto sb = input.rdbuf();
-
-    while (true)
+public:
+    explicit lazy_string(std::string_view source)
+        : value<std::string>{std::string{}},
+          source_{source}
     {
-        auto c = sb->sbumpc();
-        if (c == '\r')
-        {
-            if (sb->sgetc() == '\n')
-                c = sb->sbumpc();
-        }
-
-        if (c == '\n')
-            return input;
+        lazy_ = true;
+    }
 
-        if (c == std::istream::traits_type::eof())
-        {
-            if (line.empty())
-                input.setstate(std::ios::eofbit);
-            return input;
-        }
+private:
+    std::string_view source_;
+    mutable std::once_flag decoded_;
 
-        line.push_back(static_cast<char>(c));
+    void decode() const override
+    {
+        std::call_once(decoded_, [this]()
+                       {
+                           // data_ is only written here, before any reader sees it
+                           const_cast<std::string &>(data_) = decode_string(source_); });
     }
-}
+};
 } // namespace detail
 
 /**
- * The parser class.
+ * The parser class. It builds the node tree of a document out of the
+ * events of an event_parser, checking that tables and keys are defined
+ * only once.
  */
 class parser
 {
+    friend class event_parser<parser>;
+
 public:
+    using iterator = const char *;
+
+    /**
+     * Parsers are constructed over a contiguous buffer, which must outlive
+     * the call to parse().
+     */
+    parser(std::string_view source, const parse_options &options = {})
+        : source_(source)
+    {
+        init(options);
+    }
+
     /**
-     * Parsers are constructed from streams.
+     * Parsers constructed from streams read the whole stream up front and
+     * then parse it as a single buffer.
      */
-    parser(std::istream &stream)
-        : input_(stream) {}
+    parser(std::istream &stream, const parse_options &options = {})
+        : buffer_{std::istreambuf_iterator<char>{stream}, std::istreambuf_iterator<char>{}},
+          source_(buffer_)
+    {
+        init(options);
+    }
 
+    parser(const parser &parser) = delete;
     parser &operator=(const parser &parser) = delete;
 
     /**
-     * Parses the stream this parser was created on until EOF.
+     * Parses the buffer this parser was created on until the end.
      * @throw parse_exception if there are errors in parsing
      */
     std::shared_ptr<table> parse()
     {
-        std::shared_ptr<table> root = make_table();
+        std::shared_ptr<table> root;
+        if (options_.threads != 1)
+        {
+            root = parse_parallel();
+        }
 
-        table *curr_table = root.get();
+        if (!root)
+        {
+            root_ = new_table();
+            curr_table_ = root_.get();
+            curr_selection_ = &selection_;
+            containers_.clear();
+            skip_depth_ = 0;
+            event_parser<parser>{document_source(), *this, first_line_}.parse();
+            root = std::move(root_);
+        }
 
-        while (detail::getline(input_, line_))
+        if (arena_)
         {
-            line_number_++;
-            auto it = line_.begin();
-            auto end = line_.end();
-            consume_whitespace(it, end);
-            if (it == end || *it == '#')
-                continue;
-            if (*it == '[')
-            {
-                curr_table = root.get();
-                parse_table(it, end, curr_table);
-            }
-            else
-            {
-                parse_key_value(it, end, curr_table);
-                consume_whitespace(it, end);
-                eol_or_comment(it, end);
-            }
+            // the document is about to be handed out
+            arena_->share();
         }
         return root;
     }
 
 private:
+    /**
+     * The smallest piece of a document parsed on a thread of its own.
+     */
+    static constexpr size_t parallel_chunk_size = 128 * 1024;
+
+    /**
+     * A piece of the source for a parallel parse, starting at a header.
+     */
+    struct chunk
+    {
+        iterator begin;
+        size_t line;
+    };
+
+    /**
+     * The key/value pairs following a header, parsed into a table of their
+     * own. The first section of the document has no header.
+     */
+    struct section
+    {
+        std::vector<std::string> name;
+        bool is_array;
+        source_position position;
+        std::shared_ptr<table> body;
+    };
+
+    /**
+     * The keys of parse_options::select, as a tree. Everything below a
+     * node that is selected in full is kept.
+     */
+    struct selection
+    {
+        bool all{false};
+        std::unordered_map<std::string, std::unique_ptr<selection>> children;
+    };
+
+    /**
+     * An array or inline table whose elements are being parsed.
+     */
+    struct container
+    {
+        array *arr;
+        table *tbl;
+        const selection *filter;
+    };
+
+    void init(const parse_options &options)
+    {
+        options_ = options;
+        table_storage_ = options.tables;
+        init_selection(options.select);
+        if (options.shared_keys)
+        {
+            keys_.emplace(&key_pool::global());
+        }
+        else
+        {
+            keys_.emplace();
+        }
+        if (options.use_arena || options.lazy)
+        {
+            // start with a block about the size of the source; the arena
+            // grows geometrically from there
+            arena_ = std::make_shared<arena>(std::clamp<size_t>(source_.size(), 4096, 1 << 20));
+            allocator_.emplace(arena_);
+        }
+    }
+
+    void init_selection(const std::vector<path> &paths)
+    {
+        selection_.all = paths.empty();
+        for (const auto &p : paths)
+        {
+            auto *s = &selection_;
+            for (const auto &seg : p.segments())
+            {
+                if (seg.is_index)
+                    throw std::invalid_argument("parse_options::select paths cannot contain array indices");
+                auto &child = s->children[seg.key.str()];
+                if (!child)
+                    child = std::make_unique<selection>();
+                s = child.get();
+            }
+            s->all = true;
+        }
+    }
+
+    /**
+     * The selection below key, null if nothing there is selected.
+     */
+    static const selection *select(const selection *s, const std::string &key)
+    {
+        if (!s || s->all)
+            return s;
+        auto found = s->children.find(key);
+        return found != s->children.end() ? found->second.get() : nullptr;
+    }
+
+    /**
+     * The source the values of the document are parsed from: for lazy
+     * documents, a copy in the arena, as their strings point into it.
+     */
+    std::string_view document_source()
+    {
+        if (!options_.lazy)
+            return source_;
+
+        auto *copy = static_cast<char *>(arena_->allocate(source_.size(), 1));
+        std::memcpy(copy, source_.data(), source_.size());
+        return {copy, source_.size()};
+    }
+
+    template <class T>
+    auto new_value(T &&val)
+    {
+        return allocator_ ? allocate_value(*allocator_, std::forward<T>(val))
+                          : make_value(std::forward<T>(val));
+    }
+
+    std::shared_ptr<array> new_array()
+    {
+        return allocator_ ? allocate_array(*allocator_) : make_array();
+    }
+
+    std::shared_ptr<table> new_table(bool is_inline = false)
+    {
+        return allocator_ ? allocate_table(*allocator_, is_inline, table_storage_)
+                          : make_table(is_inline, table_storage_);
+    }
+
 #if defined _MSC_VER
     __declspec(noreturn)
 #elif defined __GNUC__
     __attribute__((noreturn))
 #endif
     void
-    throw_parse_exception(const std::string &err)
+    throw_parse_exception(const std::string &err, const source_position &position)
     {
-        throw parse_error{err, line_number_};
+        throw parse_error{err, position};
     }
 
-    void parse_table(std::string::iterator &it,
-                     const std::string::iterator &end, table *&curr_table)
+    void on_table_header(span<const std::string> name, bool is_array,
+                         const source_position &position)
     {
-        // remove the beginning keytable marker
-        ++it;
-        if (it == end)
-            throw_parse_exception("Unexpected end of table");
-        if (*it == '[')
-            parse_table_array(it, end, curr_table);
+        curr_selection_ = &selection_;
+        for (const auto &part : name)
+        {
+            curr_selection_ = select(curr_selection_, part);
+        }
+        if (!curr_selection_)
+        {
+            // nothing in this table is kept
+            curr_table_ = nullptr;
+            return;
+        }
+
+        if (sections_)
+        {
+            // resolved when the sections are merged
+            sections_->push_back({{name.begin(), name.end()}, is_array, position, new_table()});
+            curr_table_ = sections_->back().body.get();
+            return;
+        }
+
+        curr_table_ = root_.get();
+        if (is_array)
+            open_table_array(name, position);
         else
-            parse_single_table(it, end, curr_table);
+            open_table(name, position);
     }
 
-    void parse_single_table(std::string::iterator &it,
-                            const std::string::iterator &end,
-                            table *&curr_table)
+    void open_table(span<const std::string> name, const source_position &position)
     {
-        if (it == end || *it == ']')
-            throw_parse_exception("Table name cannot be empty");
-
         std::string full_table_name;
         bool inserted = false;
 
-        auto key_end = [](char c)
-        { return c == ']'; };
-
-        auto key_part_handler = [&](const std::string &part)
+        for (const auto &part : name)
         {
-            if (part.empty())
-                throw_parse_exception("Empty component of table name");
-
             if (!full_table_name.empty())
                 full_table_name += '.';
             full_table_name += part;
 
-            if (curr_table->contains(part))
+            auto k = keys_->intern(part);
+            if (auto found = curr_table_->find(k); found != curr_table_->end())
             {
-                auto b = curr_table->at(part);
+                const auto &b = found->second;
                 if (b->is<table>())
-                    curr_table = static_cast<table *>(b.get());
+                    curr_table_ = static_cast<table *>(b.get());
                 else if (b->is_table_array())
-                    curr_table = b->as<array>()->back()->as<table>().get();
+                    curr_table_ = b->as<array>()->back()->as<table>().get();
                 else
-                    throw_parse_exception("Key " + full_table_name + "already exists as a value");
+                    throw_parse_exception("Key " + full_table_name + "already exists as a value", position);
             }
             else
             {
                 inserted = true;
-                curr_table->emplace(part, make_table());
-                curr_table = static_cast<table *>(curr_table->at(part).get());
+                auto [it, success] = curr_table_->emplace(std::move(k), new_table());
+                curr_table_ = static_cast<table *>(it->second.get());
             }
-        };
-
-        key_part_handler(parse_key(it, end, key_end, key_part_handler));
-
-        if (it == end)
-            throw_parse_exception(
-                "Unterminated table declaration; did you forget a ']'?");
-
-        if (*it != ']')
-        {
-            std::string errmsg{"Unexpected character in table definition: "};
-            errmsg += '"';
-            errmsg += *it;
-            errmsg += '"';
-            throw_parse_exception(errmsg);
         }
 
         // table already existed
         if (!inserted)
         {
-            auto is_value = [](const std::pair<const std::string &,
-                                               const std::shared_ptr<node> &> &p)
+            auto is_value = [](const table::entry &p)
             {
                 return p.second->is_value();
             };
@@ -341,73 +467,63 @@ private:
             // since it has already been defined. If there aren't any
             // values, then it was implicitly created by something like
             // [a.b]
-            if (curr_table->empty() || std::any_of(curr_table->begin(), curr_table->end(),
-                                                   is_value))
+            if (curr_table_->empty() || std::any_of(curr_table_->begin(), curr_table_->end(),
+                                                    is_value))
             {
-                throw_parse_exception("Redefinition of table " + full_table_name);
+                throw_parse_exception("Redefinition of table " + full_table_name, position);
             }
         }
-
-        ++it;
-        consume_whitespace(it, end);
-        eol_or_comment(it, end);
     }
 
-    void parse_table_array(std::string::iterator &it,
-                           const std::string::iterator &end, table *&curr_table)
+    void open_table_array(span<const std::string> name, const source_position &position)
     {
-        ++it;
-        if (it == end || *it == ']')
-            throw_parse_exception("Table array name cannot be empty");
-
-        auto key_end = [](char c)
-        { return c == ']'; };
-
         std::string full_ta_name;
-        auto key_part_handler = [&](const std::string &part)
+        for (size_t i = 0; i < name.size(); ++i)
         {
-            if (part.empty())
-                throw_parse_exception("Empty component of table array name");
+            const auto &part = name[i];
+            bool last = i + 1 == name.size();
 
             if (!full_ta_name.empty())
                 full_ta_name += '.';
             full_ta_name += part;
 
-            if (curr_table->contains(part))
+            auto k = keys_->intern(part);
+            if (auto found = curr_table_->find(k); found != curr_table_->end())
             {
-                auto b = curr_table->at(part);
+                const auto &b = found->second;
 
                 // if this is the end of the table array name, add an
                 // element to the table array that we just looked up,
                 // provided it was not declared inline
-                if (it != end && *it == ']')
+                if (last)
                 {
                     if (!b->is_table_array())
                     {
-                        throw_parse_exception("key `" + full_ta_name + "` is not a table array");
+                        throw_parse_exception("key `" + full_ta_name + "` is not a table array", position);
                     }
 
-                    auto v = b->as<array>();
-                    for (auto it = v->begin(); it != v->end(); ++it)
+                    // an array written inline holds inline tables; the
+                    // array's element summary answers this in O(1)
+                    auto &v = static_cast<array &>(*b);
+                    if (v.has_inline_table())
                     {
-                        if ((*it)->as<table>()->is_inline())
-                        {
-                            throw_parse_exception("static table array `" + full_ta_name + "` cannot be appended to");
-                        }
+                        throw_parse_exception("static table array `" + full_ta_name + "` cannot be appended to",
+                                              position);
                     }
 
-                    v->push_back(make_table());
-                    curr_table = v->back()->as<table>().get();
+                    auto tbl = new_table();
+                    curr_table_ = tbl.get();
+                    v.push_back(std::move(tbl));
                 }
                 // otherwise, just keep traversing down the key name
                 else
                 {
                     if (b->is<table>())
-                        curr_table = static_cast<table *>(b.get());
+                        curr_table_ = static_cast<table *>(b.get());
                     else if (b->is_table_array())
-                        curr_table = b->as<array>()->back()->as<table>().get();
+                        curr_table_ = b->as<array>()->back()->as<table>().get();
                     else
-                        throw_parse_exception("Key " + full_ta_name + " already exists as a value");
+                        throw_parse_exception("Key " + full_ta_name + " already exists as a value", position);
                 }
             }
             else
@@ -415,1103 +531,541 @@ private:
                 // if this is the end of the table array name, add a new
                 // table array and a new table inside that array for us to
                 // add keys to next
-                if (it != end && *it == ']')
+                if (last)
                 {
-                    auto arr = make_array();
-                    arr->push_back(make_table());
-                    auto [it, success] = curr_table->emplace(part, std::move(arr));
-                    curr_table = it->second->as<array>()->back()->as<table>().get();
+                    auto arr = new_array();
+                    arr->push_back(new_table());
+                    auto [it, success] = curr_table_->emplace(std::move(k), std::move(arr));
+                    curr_table_ = it->second->as<array>()->back()->as<table>().get();
                 }
                 // otherwise, create the implicitly defined table and move
                 // down to it
                 else
                 {
-                    curr_table->emplace(part, make_table());
-                    curr_table = static_cast<table *>(curr_table->at(part).get());
+                    auto [it, success] = curr_table_->emplace(std::move(k), new_table());
+                    curr_table_ = static_cast<table *>(it->second.get());
                 }
             }
-        };
-
-        key_part_handler(parse_key(it, end, key_end, key_part_handler));
-
-        // consume the last "]]"
-        auto eat = consumer(it, end, [&]()
-                            { throw_parse_exception("Unterminated table array name"); });
-        eat(']');
-        eat(']');
-
-        consume_whitespace(it, end);
-        eol_or_comment(it, end);
+        }
     }
 
-    void parse_key_value(std::string::iterator &it, std::string::iterator &end,
-                         table *curr_table)
+    void on_key(span<const std::string> key, const source_position &position)
     {
-        auto key_end = [](char c)
-        { return c == '='; };
+        if (skip_depth_)
+            return;
+
+        const selection *s = containers_.empty() ? curr_selection_ : containers_.back().filter;
+        for (const auto &part : key)
+        {
+            s = select(s, part);
+        }
+        key_selection_ = s;
+        if (!s)
+            return;
 
-        auto key_part_handler = [&](const std::string &part)
+        auto *curr_table = containers_.empty() ? curr_table_ : containers_.back().tbl;
+
+        // every part but the last either exists already, in which case it
+        // must be a table, or doesn't exist in which case we must create an
+        // implicitly defined table
+        for (size_t i = 0; i + 1 < key.size(); ++i)
         {
-            // two cases: this key part exists already, in which case it must
-            // be a table, or it doesn't exist in which case we must create
-            // an implicitly defined table
-            if (curr_table->contains(part))
+            auto k = keys_->intern(key[i]);
+            if (auto found = curr_table->find(k); found != curr_table->end())
             {
-                auto val = curr_table->at(part);
+                const auto &val = found->second;
                 if (val->is<table>())
                 {
                     curr_table = static_cast<table *>(val.get());
                 }
                 else
                 {
-                    throw_parse_exception("Key " + part + " already exists as a value");
+                    throw_parse_exception("Key " + key[i] + " already exists as a value", position);
                 }
             }
             else
             {
-                auto [it, success] = curr_table->emplace(part, make_table());
-                curr_table = it->second->as<table>().get();
+                auto [it, success] = curr_table->emplace(std::move(k), new_table());
+                curr_table = static_cast<table *>(it->second.get());
             }
-        };
+        }
 
-        auto key = parse_key(it, end, key_end, key_part_handler);
+        auto k = keys_->intern(key[key.size() - 1]);
+        if (curr_table->contains(k))
+            throw_parse_exception("Key " + k.str() + " already present", position);
 
-        if (curr_table->contains(key))
-            throw_parse_exception("Key " + key + " already present");
-        if (it == end || *it != '=')
-            throw_parse_exception("Value must follow after a '='");
-        ++it;
-        consume_whitespace(it, end);
-        curr_table->emplace(key, parse_value(it, end));
-        consume_whitespace(it, end);
+        key_table_ = curr_table;
+        pending_key_ = std::move(k);
     }
 
-    template <class KeyEndFinder, class KeyPartHandler>
-    std::string parse_key(std::string::iterator &it, const std::string::iterator &end,
-                          KeyEndFinder &&key_end, KeyPartHandler &&key_part_handler)
+    template <class T>
+    void on_value(T &&val, const source_position &)
     {
-        // parse the key as a series of one or more simple-keys joined with '.'
-        while (it != end && !key_end(*it))
+        if (keep_value())
         {
-            auto part = parse_simple_key(it, end);
-            consume_whitespace(it, end);
-
-            if (it == end || key_end(*it))
+            // arrays stay packed while their values share one scalar type
+            if constexpr (array::is_packable<std::decay_t<T>>)
             {
-                return part;
-            }
-
-            if (*it != '.')
-            {
-                std::string errmsg{"Unexpected character in key: "};
-                errmsg += '"';
-                errmsg += *it;
-                errmsg += '"';
-                throw_parse_exception(errmsg);
+                if (in_array() && containers_.back().arr->push_packed(std::forward<T>(val)))
+                    return;
             }
-
-            key_part_handler(part);
-
-            // consume the dot
-            ++it;
+            insert(new_value(std::forward<T>(val)));
         }
-
-        throw_parse_exception("Unexpected end of key");
     }
 
-    std::string parse_simple_key(std::string::iterator &it,
-                                 const std::string::iterator &end)
+    bool raw_strings() const noexcept
     {
-        consume_whitespace(it, end);
-
-        if (it == end)
-            throw_parse_exception("Unexpected end of key (blank key?)");
-
-        if (*it == '"' || *it == '\'')
-        {
-            return string_literal(it, end, *it);
-        }
-        else
-        {
-            auto bke = std::find_if(it, end, [](char c)
-                                    { return c == '.' || c == '=' || c == ']'; });
-            return parse_bare_key(it, bke);
-        }
+        return options_.lazy;
     }
 
-    std::string parse_bare_key(std::string::iterator &it,
-                               const std::string::iterator &end)
+    void on_raw_string(std::string_view source, const source_position &)
     {
-        if (it == end)
-        {
-            throw_parse_exception("Bare key missing name");
-        }
-
-        auto key_end = end;
-        --key_end;
-        consume_backwards_whitespace(key_end, it);
-        ++key_end;
-        std::string key{it, key_end};
-
-        if (std::find(it, key_end, '#') != key_end)
-        {
-            throw_parse_exception("Bare key " + key + " cannot contain #");
-        }
-
-        if (std::find_if(it, key_end,
-                         [](char c)
-                         { return c == ' ' || c == '\t'; }) != key_end)
+        if (keep_value())
         {
-            throw_parse_exception("Bare key " + key + " cannot contain whitespace");
+            insert(std::allocate_shared<detail::lazy_string>(*allocator_, source));
         }
+    }
 
-        if (std::find_if(it, key_end,
-                         [](char c)
-                         { return c == '[' || c == ']'; }) != key_end)
+    void on_array_begin(const source_position &)
+    {
+        auto *s = selected();
+        if (!s)
         {
-            throw_parse_exception("Bare key " + key + " cannot contain '[' or ']'");
+            ++skip_depth_;
+            return;
         }
-
-        it = end;
-        return key;
+        auto arr = new_array();
+        auto *ptr = arr.get();
+        insert(std::move(arr));
+        containers_.push_back({ptr, nullptr, s});
     }
 
-    enum class numeric_type : uint8_t
+    void on_array_end(const source_position &)
     {
-        None = 0,
-        LocalTime,
-        LocalDate,
-        LocalDateTime,
-        OffsetDateTime,
-        Integer,
-        Float,
-    };
+        if (skip_depth_)
+            --skip_depth_;
+        else
+            containers_.pop_back();
+    }
 
-    std::shared_ptr<node> parse_value(std::string::iterator &it,
-                                      std::string::iterator &end)
+    void on_inline_table_begin(const source_position &)
     {
-        if (*it == '[')
-        {
-            // parse array
-            return parse_array(it, end);
-        }
-        else if (*it == '{')
-        {
-            // parse inline table
-            return parse_inline_table(it, end);
-        }
-        else if (*it == '"' || *it == '\'')
-        {
-            // STRING:
-            return parse_string(it, end);
-        }
-        else if (*it == 't' || *it == 'f')
-        {
-            // BOOL;
-            return parse_bool(it, end);
-        }
-        else
+        auto *s = selected();
+        if (!s)
         {
-            auto val_end = std::find_if(
-                it, end, [](char c)
-                { return c == ',' || c == ']' || c == '#'; });
-
-            numeric_type type = determine_numeric_type(it, val_end);
-
-            switch (type)
-            {
-            case numeric_type::LocalTime:
-                return parse_time(it, end);
-            case numeric_type::LocalDate:
-            case numeric_type::LocalDateTime:
-            case numeric_type::OffsetDateTime:
-                return parse_date(it, end);
-            case numeric_type::Integer:
-            case numeric_type::Float:
-                return parse_number(it, end);
-            default:
-                throw_parse_exception("Failed to parse value");
-            }
+            ++skip_depth_;
+            return;
         }
+        auto tbl = new_table(true);
+        auto *ptr = tbl.get();
+        insert(std::move(tbl));
+        containers_.push_back({nullptr, ptr, s});
     }
 
-    numeric_type determine_numeric_type(const std::string::iterator &it,
-                                        const std::string::iterator &end)
+    void on_inline_table_end(const source_position &)
     {
-        if (it == end)
-        {
-            return numeric_type::None;
-        }
-        else if (is_time(it, end))
-        {
-            return numeric_type::LocalTime;
-        }
-        else if (auto date_type = determine_date_type(it, end); date_type != numeric_type::None)
-        {
-            return date_type;
-        }
-        else if (std::isdigit(static_cast<unsigned char>(*it)) || *it == '-' || *it == '+' ||
-                 (*it == 'i' && it + 1 != end && it[1] == 'n' && it + 2 != end && it[2] == 'f') ||
-                 (*it == 'n' && it + 1 != end && it[1] == 'a' && it + 2 != end && it[2] == 'n'))
-        {
-            return determine_number_type(it, end);
-        }
+        if (skip_depth_)
+            --skip_depth_;
         else
-        {
-            return numeric_type::None;
-        }
+            containers_.pop_back();
     }
 
-    numeric_type determine_number_type(const std::string::iterator &it,
-                                       const std::string::iterator &end)
+    bool in_array() const noexcept
     {
-        // determine if we are an integer or a float
-        auto check_it = it;
-        if (*check_it == '-' || *check_it == '+')
-            ++check_it;
+        return !containers_.empty() && containers_.back().arr;
+    }
 
-        if (check_it == end)
-            return numeric_type::None;
+    /**
+     * Whether the value being parsed is selected: values are only kept as
+     * a whole, unless they are part of an array.
+     */
+    bool keep_value() const noexcept
+    {
+        auto *s = selected();
+        return s && (s->all || in_array());
+    }
 
-        if (*check_it == 'i' || *check_it == 'n')
-            return numeric_type::Float;
+    /**
+     * The selection of the value being parsed, null if it is skipped. The
+     * elements of an array share the selection of the array.
+     */
+    const selection *selected() const noexcept
+    {
+        if (skip_depth_)
+            return nullptr;
+        return in_array() ? containers_.back().filter : key_selection_;
+    }
 
-        while (check_it != end && std::isdigit(static_cast<unsigned char>(*check_it)))
-            ++check_it;
-        if (check_it != end && *check_it == '.')
+    /**
+     * Adds a value to the array being parsed, or under the last key.
+     */
+    void insert(std::shared_ptr<node> &&n)
+    {
+        if (in_array())
         {
-            ++check_it;
-            while (check_it != end && std::isdigit(static_cast<unsigned char>(*check_it)))
-                ++check_it;
-            return numeric_type::Float;
+            containers_.back().arr->push_back(std::move(n));
         }
         else
         {
-            return numeric_type::Integer;
+            key_table_->emplace(std::move(pending_key_), std::move(n));
         }
     }
 
-    std::shared_ptr<value<std::string>> parse_string(std::string::iterator &it,
-                                                     std::string::iterator &end)
+    /**
+     * Parses the sections of the document concurrently and merges them into
+     * the root in document order. Returns null if the document is too small
+     * to split or has an error: the sequential parse then reports the error
+     * exactly as it would otherwise.
+     */
+    std::shared_ptr<table> parse_parallel()
     {
-        auto delim = *it;
-        assert(delim == '"' || delim == '\'');
-
-        // end is non-const here because we have to be able to potentially
-        // parse multiple lines in a string, not just one
-        auto check_it = it;
-        ++check_it;
-        if (check_it != end && *check_it == delim)
+        auto threads = options_.threads ? options_.threads : thread_pool::hardware_threads();
+        auto chunks = split_source(std::max(parallel_chunk_size, source_.size() / (threads * 4)));
+        if (chunks.size() < 2)
+            return nullptr;
+
+        auto worker_options = options_;
+        worker_options.threads = 1;
+        std::vector<std::vector<section>> parsed(chunks.size());
+
+        try
         {
-            ++check_it;
-            if (check_it != end && *check_it == delim)
+            thread_pool pool{std::min(threads, chunks.size())};
+            pool.run(chunks.size(),
+                     [&](size_t i)
+                     {
+                         auto begin = chunks[i].begin;
+                         auto end = i + 1 < chunks.size() ? chunks[i + 1].begin
+                                                          : source_.data() + source_.size();
+                         parser worker{std::string_view{begin, static_cast<size_t>(end - begin)},
+                                       worker_options};
+                         worker.first_line_ = chunks[i].line;
+                         parsed[i] = worker.parse_sections();
+                     });
+
+            root_ = new_table();
+            for (auto &sections : parsed)
             {
-                it = ++check_it;
-                return parse_multiline_string(it, end, delim);
+                for (auto &s : sections)
+                {
+                    curr_table_ = root_.get();
+                    if (!s.name.empty())
+                    {
+                        on_table_header(s.name, s.is_array, s.position);
+                    }
+                    if (curr_table_)
+                    {
+                        merge_section(*curr_table_, *s.body, s.position);
+                    }
+                }
             }
+            return std::move(root_);
+        }
+        catch (const parse_error &)
+        {
+            return nullptr;
         }
-        return make_value(string_literal(it, end, delim));
     }
 
-    std::shared_ptr<value<std::string>>
-    parse_multiline_string(std::string::iterator &it,
-                           std::string::iterator &end, char delim)
+    /**
+     * Finds the chunks of a parallel parse: lines holding a top-level
+     * header, at least min_size bytes apart. Strings (multi-line ones
+     * included), comments and arrays spanning several lines are skipped,
+     * so a '[' inside them is never taken for a header.
+     */
+    std::vector<chunk> split_source(size_t min_size) const noexcept
     {
-        std::stringstream ss;
+        const iterator source_end = source_.data() + source_.size();
+        std::vector<chunk> chunks{{source_.data(), first_line_}};
+        size_t line = first_line_;
+        size_t depth = 0;
+        iterator it = source_.data();
 
-        auto is_ws = [](char c)
-        { return c == ' ' || c == '\t'; };
-
-        bool consuming = false;
-        std::shared_ptr<value<std::string>> ret;
+        auto skip_to_eol = [&]()
+        {
+            auto eol = static_cast<iterator>(std::memchr(it, '\n', source_end - it));
+            it = eol ? eol : source_end;
+        };
 
-        auto handle_line = [&](std::string::iterator &local_it,
-                               std::string::iterator &local_end)
+        while (it != source_end)
         {
-            if (consuming)
+            auto line_begin = it;
+            if (depth == 0)
             {
-                local_it = std::find_if_not(local_it, local_end, is_ws);
-
-                // whole line is whitespace
-                if (local_it == local_end)
-                    return;
+                while (it != source_end && (*it == ' ' || *it == '\t'))
+                    ++it;
+                if (it != source_end && *it == '[')
+                {
+                    if (static_cast<size_t>(line_begin - chunks.back().begin) >= min_size)
+                        chunks.push_back({line_begin, line});
+                    skip_to_eol();
+                }
             }
 
-            consuming = false;
-
-            while (local_it != local_end)
+            while (it != source_end && *it != '\n')
             {
-                // handle escaped characters
-                if (delim == '"' && *local_it == '\\')
+                char c = *it++;
+                switch (c)
                 {
-                    auto check = local_it;
-                    // check if this is an actual escape sequence or a
-                    // whitespace escaping backslash
-                    ++check;
-                    consume_whitespace(check, local_end);
-                    if (check == local_end)
+                case '#':
+                    skip_to_eol();
+                    break;
+                case '[':
+                case '{':
+                    ++depth;
+                    break;
+                case ']':
+                case '}':
+                    depth -= depth > 0;
+                    break;
+                case '"':
+                case '\'':
+                    if (source_end - it >= 2 && it[0] == c && it[1] == c)
                     {
-                        consuming = true;
-                        break;
+                        // multi-line string: skip to the closing run of quotes
+                        it += 2;
+                        while (it != source_end &&
+                               !(source_end - it >= 3 && it[0] == c && it[1] == c && it[2] == c))
+                        {
+                            if (c == '"' && *it == '\\' && source_end - it >= 2)
+                                ++it;
+                            line += *it++ == '\n';
+                        }
+                        while (it != source_end && *it == c)
+                            ++it;
                     }
-
-                    ss << parse_escape_code(local_it, local_end);
-                    continue;
-                }
-
-                // if we can end the string
-                if (std::distance(local_it, local_end) >= 3)
-                {
-                    auto check = local_it;
-                    // check for """
-                    if (*check++ == delim && *check++ == delim && *check++ == delim)
+                    else
                     {
-                        local_it = check;
-                        ret = make_value<std::string>(ss.str());
-                        break;
+                        while (it != source_end && *it != c && *it != '\n')
+                        {
+                            if (c == '"' && *it == '\\' && source_end - it >= 2 && it[1] != '\n')
+                                ++it;
+                            ++it;
+                        }
+                        if (it != source_end && *it == c)
+                            ++it;
                     }
+                    break;
                 }
-
-                ss << *local_it++;
             }
-        };
-
-        // handle the remainder of the current line
-        handle_line(it, end);
-        if (ret)
-            return ret;
-
-        // start eating lines
-        while (detail::getline(input_, line_))
-        {
-            ++line_number_;
-
-            it = line_.begin();
-            end = line_.end();
 
-            handle_line(it, end);
-
-            if (ret)
-                return ret;
-
-            if (!consuming)
-                ss << std::endl;
-        }
-
-        throw_parse_exception("Unterminated multi-line basic string");
-    }
-
-    std::string string_literal(std::string::iterator &it,
-                               const std::string::iterator &end, char delim)
-    {
-        ++it;
-        std::string val;
-        while (it != end)
-        {
-            // handle escaped characters
-            if (delim == '"' && *it == '\\')
-            {
-                val += parse_escape_code(it, end);
-            }
-            else if (*it == delim)
+            if (it != source_end)
             {
                 ++it;
-                consume_whitespace(it, end);
-                return val;
+                ++line;
             }
-            else
-            {
-                val += *it++;
-            }
-        }
-        throw_parse_exception("Unterminated string literal");
-    }
-
-    std::string parse_escape_code(std::string::iterator &it,
-                                  const std::string::iterator &end)
-    {
-        ++it;
-        if (it == end)
-            throw_parse_exception("Invalid escape sequence");
-        char value;
-        if (*it == 'b')
-        {
-            value = '\b';
-        }
-        else if (*it == 't')
-        {
-            value = '\t';
-        }
-        else if (*it == 'n')
-        {
-            value = '\n';
-        }
-        else if (*it == 'f')
-        {
-            value = '\f';
         }
-        else if (*it == 'r')
-        {
-            value = '\r';
-        }
-        else if (*it == '"')
-        {
-            value = '"';
-        }
-        else if (*it == '\\')
-        {
-            value = '\\';
-        }
-        else if (*it == 'u' || *it == 'U')
-        {
-            return parse_unicode(it, end);
-        }
-        else
-        {
-            throw_parse_exception("Invalid escape sequence");
-        }
-        ++it;
-        return std::string(1, value);
+        return chunks;
     }
 
-    std::string parse_unicode(std::string::iterator &it,
-                              const std::string::iterator &end)
+    /**
+     * Parses the key/value pairs of a chunk of a parallel parse into one
+     * table per section, leaving the headers to be resolved by the merge.
+     */
+    std::vector<section> parse_sections()
     {
-        bool large = *it++ == 'U';
-        auto codepoint = parse_hex(it, end, large ? 0x10000000 : 0x1000);
-
-        if ((codepoint > 0xd7ff && codepoint < 0xe000) || codepoint > 0x10ffff)
-        {
-            throw_parse_exception(
-                "Unicode escape sequence is not a Unicode scalar value");
-        }
+        std::vector<section> sections;
+        sections.push_back({{}, false, {first_line_, 1}, new_table()});
+        curr_table_ = sections.back().body.get();
+        curr_selection_ = &selection_;
 
-        std::string result;
-        // See Table 3-6 of the Unicode standard
-        if (codepoint <= 0x7f)
-        {
-            // 1-byte codepoints: 00000000 0xxxxxxx
-            // repr: 0xxxxxxx
-            result += static_cast<char>(codepoint & 0x7f);
-        }
-        else if (codepoint <= 0x7ff)
-        {
-            // 2-byte codepoints: 00000yyy yyxxxxxx
-            // repr: 110yyyyy 10xxxxxx
-            //
-            // 0x1f = 00011111
-            // 0xc0 = 11000000
-            //
-            result += static_cast<char>(0xc0 | ((codepoint >> 6) & 0x1f));
-            //
-            // 0x80 = 10000000
-            // 0x3f = 00111111
-            //
-            result += static_cast<char>(0x80 | (codepoint & 0x3f));
-        }
-        else if (codepoint <= 0xffff)
-        {
-            // 3-byte codepoints: zzzzyyyy yyxxxxxx
-            // repr: 1110zzzz 10yyyyyy 10xxxxxx
-            //
-            // 0xe0 = 11100000
-            // 0x0f = 00001111
-            //
-            result += static_cast<char>(0xe0 | ((codepoint >> 12) & 0x0f));
-            result += static_cast<char>(0x80 | ((codepoint >> 6) & 0x1f));
-            result += static_cast<char>(0x80 | (codepoint & 0x3f));
-        }
-        else
-        {
-            // 4-byte codepoints: 000uuuuu zzzzyyyy yyxxxxxx
-            // repr: 11110uuu 10uuzzzz 10yyyyyy 10xxxxxx
-            //
-            // 0xf0 = 11110000
-            // 0x07 = 00000111
-            //
-            result += static_cast<char>(0xf0 | ((codepoint >> 18) & 0x07));
-            result += static_cast<char>(0x80 | ((codepoint >> 12) & 0x3f));
-            result += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3f));
-            result += static_cast<char>(0x80 | (codepoint & 0x3f));
-        }
-        return result;
-    }
+        sections_ = &sections;
+        event_parser<parser>{document_source(), *this, first_line_}.parse();
+        sections_ = nullptr;
 
-    uint32_t parse_hex(std::string::iterator &it,
-                       const std::string::iterator &end, uint32_t place)
-    {
-        uint32_t value = 0;
-        while (place > 0)
+        if (arena_)
         {
-            if (it == end)
-                throw_parse_exception("Unexpected end of unicode sequence");
-
-            if (!std::isxdigit(static_cast<unsigned char>(*it)))
-                throw_parse_exception("Invalid unicode escape sequence");
-
-            value += place * hex_to_digit(*it++);
-            place /= 16;
+            arena_->share();
         }
-        return value;
+        return sections;
     }
 
-    uint32_t hex_to_digit(char c)
-    {
-        if (std::isdigit(static_cast<unsigned char>(c)))
-        {
-            return static_cast<uint32_t>(c - '0');
-        }
-        else
-        {
-            return 10 + static_cast<uint32_t>(c - ((c >= 'a' && c <= 'f') ? 'a' : 'A'));
-        }
-    }
-
-    std::shared_ptr<node> parse_number(std::string::iterator &it,
-                                       const std::string::iterator &end)
+    /**
+     * Moves the key/value pairs of a section into the table its header
+     * resolved to, as if they had been parsed into it. Tables the section
+     * created for dotted keys extend existing tables of the same name.
+     */
+    void merge_section(table &into, table &from, const source_position &position)
     {
-        auto check_it = it;
-        auto check_end = find_end_of_number(it, end);
-
-        auto eat_sign = [&]()
-        {
-            if (check_it != end && (*check_it == '-' || *check_it == '+'))
-                ++check_it;
-        };
-
-        auto check_no_leading_zero = [&]()
-        {
-            if (check_it != end && *check_it == '0' && check_it + 1 != check_end && check_it[1] != '.')
-            {
-                throw_parse_exception("Numbers may not have leading zeros");
-            }
-        };
-
-        auto eat_digits = [&](std::function<bool(char)> &&check_char)
-        {
-            auto beg = check_it;
-            while (check_it != end && check_char(*check_it))
-            {
-                ++check_it;
-                if (check_it != end && *check_it == '_')
-                {
-                    ++check_it;
-                    if (check_it == end || !check_char(*check_it))
-                        throw_parse_exception("Malformed number 1");
-                }
-            }
-
-            if (check_it == beg)
-                throw_parse_exception("Malformed number 2");
-        };
-
-        auto eat_hex = [&]()
-        {
-            eat_digits([](char c) -> bool
-                       { return std::isxdigit(static_cast<unsigned char>(c)); });
-        };
-        auto eat_decimal = [&]()
-        {
-            eat_digits([](char c) -> bool
-                       { return std::isdigit(static_cast<unsigned char>(c)); });
-        };
-
-        if (check_it != end && *check_it == '0' && check_it + 1 != check_end &&
-            (check_it[1] == 'x' || check_it[1] == 'o' || check_it[1] == 'b'))
-        {
-            ++check_it;
-            char base = *check_it;
-            ++check_it;
-            if (base == 'x')
-            {
-                eat_hex();
-                return parse_int(it, check_it, 16);
-            }
-            else if (base == 'o')
-            {
-                auto start = check_it;
-                eat_decimal();
-                auto val = parse_int(start, check_it, 8, "0");
-                it = start;
-                return val;
-            }
-            else // if (base == 'b')
-            {
-                auto start = check_it;
-                eat_decimal();
-                auto val = parse_int(start, check_it, 2);
-                it = start;
-                return val;
-            }
-        }
-
-        eat_sign();
-        check_no_leading_zero();
-
-        if (check_it != end && check_it + 1 != end && check_it + 2 != end)
+        for (auto &[k, v] : from)
         {
-            if (check_it[0] == 'i' && check_it[1] == 'n' && check_it[2] == 'f')
+            auto found = into.find(k);
+            if (found == into.end())
             {
-                auto val = std::numeric_limits<double>::infinity();
-                if (*it == '-')
-                    val = -val;
-                it = check_it + 3;
-                return make_value(std::move(val));
+                into.emplace(k, std::move(v));
             }
-            else if (check_it[0] == 'n' && check_it[1] == 'a' && check_it[2] == 'n')
+            else if (v->is<table>() && !static_cast<table &>(*v).is_inline() &&
+                     found->second->is<table>())
             {
-                auto val = std::numeric_limits<double>::quiet_NaN();
-                if (*it == '-')
-                    val = -val;
-                it = check_it + 3;
-                return make_value(std::move(val));
+                merge_section(static_cast<table &>(*found->second), static_cast<table &>(*v), position);
             }
-        }
-
-        eat_decimal();
-
-        if (check_it != end && (*check_it == '.' || *check_it == 'e' || *check_it == 'E'))
-        {
-            bool is_exp = *check_it == 'e' || *check_it == 'E';
-
-            ++check_it;
-            if (check_it == end)
-                throw_parse_exception("Floats must have trailing digits");
-
-            auto eat_exp = [&]()
-            {
-                eat_sign();
-                check_no_leading_zero();
-                eat_decimal();
-            };
-
-            if (is_exp)
-                eat_exp();
             else
-                eat_decimal();
-
-            if (!is_exp && check_it != end && (*check_it == 'e' || *check_it == 'E'))
             {
-                ++check_it;
-                eat_exp();
+                throw_parse_exception("Key " + k.str() + " already present", position);
             }
-
-            return parse_float(it, check_it);
-        }
-        else
-        {
-            return parse_int(it, check_it);
         }
     }
 
-    std::shared_ptr<value<int64_t>> parse_int(std::string::iterator &it,
-                                              const std::string::iterator &end,
-                                              int base = 10,
-                                              const char *prefix = "")
-    {
-        std::string v{it, end};
-        v = prefix + v;
-        v.erase(std::remove(v.begin(), v.end(), '_'), v.end());
-        it = end;
-        try
-        {
-            return make_value<int64_t>(std::stoll(v, nullptr, base));
-        }
-        catch (const std::invalid_argument &ex)
-        {
-            throw_parse_exception("Malformed number (invalid argument: " + std::string{ex.what()} + ")");
-        }
-        catch (const std::out_of_range &ex)
-        {
-            throw_parse_exception("Malformed number (out of range: " + std::string{ex.what()} + ")");
-        }
-    }
-
-    std::shared_ptr<value<double>> parse_float(std::string::iterator &it,
-                                               const std::string::iterator &end)
-    {
-        std::string v{it, end};
-        v.erase(std::remove(v.begin(), v.end(), '_'), v.end());
-        it = end;
-        char decimal_point = std::localeconv()->decimal_point[0];
-        std::replace(v.begin(), v.end(), '.', decimal_point);
-        try
-        {
-            return make_value<double>(std::stod(v));
-        }
-        catch (const std::invalid_argument &ex)
-        {
-            throw_parse_exception("Malformed number (invalid argument: " + std::string{ex.what()} + ")");
-        }
-        catch (const std::out_of_range &ex)
-        {
-            throw_parse_exception("Malformed number (out of range: " + std::string{ex.what()} + ")");
-        }
-    }
-
-    std::shared_ptr<value<bool>> parse_bool(std::string::iterator &it,
-                                            const std::string::iterator &end)
-    {
-        auto eat = consumer(it, end, [&]()
-                            { throw_parse_exception("attempt to parse invalid boolean value"); });
-
-        if (*it == 't')
-        {
-            eat("true");
-            return make_value<bool>(true);
-        }
-        else if (*it == 'f')
-        {
-            eat("false");
-            return make_value<bool>(false);
-        }
-        else
-        {
-            // should be unreachable
-            throw_parse_exception("attempt to parse invalid boolean value: " +
-                                  std::string{it, end});
-            return nullptr;
-        }
-    }
-
-    std::string::iterator find_end_of_array_element(std::string::iterator it,
-                                                    std::string::iterator end)
-    {
-        auto ret = std::find_if(it, end, [](char c)
-                                { return !std::isdigit(static_cast<unsigned char>(c)) &&
-                                         c != '_' && c != '.' && c != 'e' &&
-                                         c != 'E' && c != '-' && c != '+' &&
-                                         c != 'x' && c != 'o' && c != 'b'; });
-        if (ret != end && ret + 1 != end && ret + 2 != end)
-        {
-            if ((ret[0] == 'i' && ret[1] == 'n' && ret[2] == 'f') ||
-                (ret[0] == 'n' && ret[1] == 'a' && ret[2] == 'n'))
-            {
-                ret = ret + 3;
-            }
-        }
-        return ret;
-    }
-
-    std::string::iterator find_end_of_number(std::string::iterator it,
-                                             std::string::iterator end)
-    {
-        auto ret = std::find_if(it, end, [](char c)
-                                { return !std::isdigit(static_cast<unsigned char>(c)) &&
-                                         c != '_' && c != '.' && c != 'e' &&
-                                         c != 'E' && c != '-' && c != '+' &&
-                                         c != 'x' && c != 'o' && c != 'b'; });
-        if (ret != end && ret + 1 != end && ret + 2 != end)
-        {
-            if ((ret[0] == 'i' && ret[1] == 'n' && ret[2] == 'f') ||
-                (ret[0] == 'n' && ret[1] == 'a' && ret[2] == 'n'))
-            {
-                ret = ret + 3;
-            }
-        }
-        return ret;
-    }
-
-    std::string::iterator find_end_of_date(std::string::iterator it,
-                                           std::string::iterator end)
-    {
-        auto end_of_date = std::find_if(it, end, [](char c)
-                                        { return !std::isdigit(static_cast<unsigned char>(c)) && c != '-'; });
-
-        if (end_of_date != end && *end_of_date == ' ' && end_of_date + 1 != end &&
-            std::isdigit(static_cast<unsigned char>(end_of_date[1])))
-        {
-            end_of_date++;
-        }
-
-        return std::find_if(end_of_date, end, [](char c)
-                            { return !std::isdigit(static_cast<unsigned char>(c)) &&
-                                     c != 'T' && c != 'Z' && c != ':' &&
-                                     c != '-' && c != '+' && c != '.'; });
-    }
+    std::string buffer_;
+    std::string_view source_;
+    size_t first_line_{1};
+    std::shared_ptr<arena> arena_;
+    std::optional<arena_allocator<node>> allocator_;
+    parse_options options_;
+    table_storage table_storage_{table_storage::ordered};
+    std::optional<key_pool> keys_;
+    std::shared_ptr<table> root_;
+    selection selection_;
+    table *curr_table_{nullptr};
+    const selection *curr_selection_{nullptr};
+    table *key_table_{nullptr};
+    key pending_key_;
+    const selection *key_selection_{nullptr};
+    std::vector<container> containers_;
+    size_t skip_depth_{0};
+    std::vector<section> *sections_{nullptr};
+};
 
-    std::string::iterator find_end_of_time(std::string::iterator it,
-                                           std::string::iterator end)
+namespace detail
+{
+inline parse_result make_parse_result(std::shared_ptr<table> &&root, const parse_options &options)
+{
+    if (options.compact)
     {
-        return std::find_if(it, end, [](char c)
-                            { return !std::isdigit(static_cast<unsigned char>(c)) && c != ':' && c != '.'; });
-    }
-
-    local_time read_time(std::string::iterator &it,
-                         const std::string::iterator &end)
-    {
-        auto time_end = find_end_of_time(it, end);
-
-        auto eat = consumer(it, time_end, [&]()
-                            { throw_parse_exception("Malformed time"); });
-
-        local_time ltime;
-
-        ltime.hour = eat.eat_digits(2);
-        eat(':');
-        ltime.minute = eat.eat_digits(2);
-        eat(':');
-        ltime.second = eat.eat_digits(2);
-
-        int power = 100000;
-        if (it != time_end && *it == '.')
-        {
-            ++it;
-            while (it != time_end && std::isdigit(static_cast<unsigned char>(*it)))
-            {
-                ltime.nanosecond += power * (*it++ - '0') * 1000;
-                power /= 10;
-            }
-        }
-
-        if (it != time_end)
-            throw_parse_exception("Malformed time");
-
-        return ltime;
+        return {make_document(*root)->view()};
     }
+    return {std::move(root)};
+}
+} // namespace detail
 
-    std::shared_ptr<value<local_time>>
-    parse_time(std::string::iterator &it, const std::string::iterator &end)
-    {
-        return make_value(read_time(it, end));
-    }
+/**
+ * Parses a file in place: regular files are memory-mapped and parsed
+ * directly out of the mapping, anything else is read into a single buffer.
+ */
+inline parse_result parse_file(const std::string &file_path, const parse_options &options = {})
+{
+    mapped_file file{file_path};
 
-    std::shared_ptr<node> parse_date(std::string::iterator &it,
-                                     const std::string::iterator &end)
+    if (!file.is_open())
     {
-        auto date_end = find_end_of_date(it, end);
-
-        auto eat = consumer(it, date_end, [&]()
-                            { throw_parse_exception("Malformed date"); });
-
-        local_date ldate;
-        ldate.year = eat.eat_digits(4);
-        eat('-');
-        ldate.month = eat.eat_digits(2);
-        eat('-');
-        ldate.day = eat.eat_digits(2);
-
-        if (it == date_end)
-            return make_value(std::move(ldate));
-
-        eat.eat_either('T', ' ');
-
-        local_date_time ldt(std::move(ldate), read_time(it, date_end));
-
-        if (it == date_end)
-            return make_value(std::move(ldt));
-
-        offset_date_time dt;
-        static_cast<local_date_time &>(dt) = ldt;
-
-        int hoff = 0;
-        int moff = 0;
-        if (*it == '+' || *it == '-')
-        {
-            auto plus = *it == '+';
-            ++it;
-
-            hoff = eat.eat_digits(2);
-            eat(':');
-            moff = eat.eat_digits(2);
-
-            static_cast<time_offset &>(dt) = time_offset((plus) ? hoff : -hoff,
-                                                         (plus) ? moff : -moff);
-        }
-        else if (*it == 'Z')
-        {
-            ++it;
-        }
-
-        if (it != date_end)
-            throw_parse_exception("Malformed date");
-
-        return make_value(std::move(dt));
+        return {parse_error(file_path + " could not be opened for parsing")};
     }
-
-    std::shared_ptr<node> parse_array(std::string::iterator &it,
-                                      std::string::iterator &end)
+    else
     {
-        // toml v1.0.0-rc.1 removed the "homogeneity" restriction:
-        // arrays can either be homogeneous, or contain mixed types
-
-        ++it;
-        skip_whitespace_and_comments(it, end);
-
-        auto arr = make_array();
-        while (it != end && *it != ']')
-        {
-            skip_whitespace_and_comments(it, end);
-            arr->push_back(parse_value(it, end));
-            skip_whitespace_and_comments(it, end);
-            if (*it != ',')
-                break;
-            ++it;
-            skip_whitespace_and_comments(it, end);
-        }
-
-        if (it == end)
-        {
-            throw_parse_exception("missing closing `]` in array");
-        }
-        else
+        try
         {
-            ++it;
-            return arr;
+            parser p{file.view(), options};
+            return detail::make_parse_result(p.parse(), options);
         }
-    }
-
-    std::shared_ptr<table> parse_inline_table(std::string::iterator &it,
-                                              std::string::iterator &end)
-    {
-        auto tbl = make_table(true);
-        do
-        {
-            ++it;
-            if (it == end)
-                throw_parse_exception("Unterminated inline table");
-
-            consume_whitespace(it, end);
-            if (it != end && *it != '}')
-            {
-                parse_key_value(it, end, tbl.get());
-                consume_whitespace(it, end);
-            }
-        } while (*it == ',');
-
-        if (it == end || *it != '}')
-            throw_parse_exception("Unterminated inline table");
-
-        ++it;
-        consume_whitespace(it, end);
-
-        return tbl;
-    }
-
-    void skip_whitespace_and_comments(std::string::iterator &start,
-                                      std::string::iterator &end)
-    {
-        consume_whitespace(start, end);
-        while (start == end || *start == '#')
+        catch (const parse_error &e)
         {
-            if (!detail::getline(input_, line_))
-                throw_parse_exception("Unclosed array");
-            line_number_++;
-            start = line_.begin();
-            end = line_.end();
-            consume_whitespace(start, end);
+            return {std::move(e)};
         }
     }
+}
 
-    void consume_whitespace(std::string::iterator &it,
-                            const std::string::iterator &end)
+inline parse_result parse(std::string_view source, const parse_options &options = {})
+{
+    try
     {
-        while (it != end && (*it == ' ' || *it == '\t'))
-            ++it;
+        parser p{source, options};
+        return detail::make_parse_result(p.parse(), options);
     }
-
-    void consume_backwards_whitespace(std::string::iterator &back,
-                                      const std::string::iterator &front)
+    catch (const parse_error &e)
     {
-        while (back != front && (*back == ' ' || *back == '\t'))
-            --back;
+        return {e};
     }
+}
 
-    void eol_or_comment(const std::string::iterator &it,
-                        const std::string::iterator &end)
+/**
+ * Parses several files on a thread pool.
+ *
+ * The largest files are started first, so that they do not end up
+ * running alone at the end of the batch.
+ * @return one result per file, in the order of files; files that could not
+ *         be opened or parsed have an error result
+ */
+inline std::vector<parse_result> parse_files(span<const std::filesystem::path> files,
+                                             const parse_options &options,
+                                             thread_pool &pool)
+{
+    std::vector<std::pair<std::uintmax_t, size_t>> order;
+    order.reserve(files.size());
+    for (size_t i = 0; i < files.size(); ++i)
     {
-        if (it != end && *it != '#')
-            throw_parse_exception("Unidentified trailing character '" + std::string{*it} + "'---did you forget a '#'?");
+        std::error_code ec;
+        auto size = std::filesystem::file_size(files[i], ec);
+        order.emplace_back(ec ? 0 : size, i);
     }
-
-    bool is_time(const std::string::iterator &it,
-                 const std::string::iterator &end)
+    std::stable_sort(order.begin(), order.end(),
+                     [](const auto &lhs, const auto &rhs)
+                     { return lhs.first > rhs.first; });
+
+    std::vector<std::optional<parse_result>> parsed(files.size());
+    pool.run(order.size(),
+             [&](size_t task)
+             {
+                 auto i = order[task].second;
+                 parsed[i].emplace(parse_file(files[i].string(), options));
+             });
+
+    std::vector<parse_result> results;
+    results.reserve(parsed.size());
+    for (auto &result : parsed)
     {
-        auto time_end = find_end_of_time(it, end);
-        auto len = std::distance(it, time_end);
-
-        if (len < 8)
-            return false;
-
-        if (it[2] != ':' || it[5] != ':')
-            return false;
-
-        if (len > 8)
-            return it[8] == '.' && len > 9;
-
-        return true;
+        results.push_back(std::move(*result));
     }
+    return results;
+}
 
-    numeric_type determine_date_type(const std::string::iterator &it,
-                                     const std::string::iterator &end)
-    {
-        auto date_end = find_end_of_date(it, end);
-        auto len = std::distance(it, date_end);
-
-        if (len < 10)
-            return numeric_type::None;
-        ;
-
-        if (it[4] != '-' || it[7] != '-')
-            return numeric_type::None;
-
-        if (len >= 19 && (it[10] == 'T' || it[10] == ' ') && is_time(it + 11, date_end))
-        {
-            // datetime type
-            auto time_end = find_end_of_time(it + 11, date_end);
-            if (time_end == date_end)
-                return {numeric_type::LocalDateTime};
-            else
-                return {numeric_type::OffsetDateTime};
-        }
-        else if (len == 10)
-        {
-            // just a regular date
-            return {numeric_type::LocalDate};
-        }
-
-        return {};
-    }
+/**
+ * Parses several files on a pool of the given number of threads, the
+ * calling one included; 0 for one per hardware thread.
+ */
+inline std::vector<parse_result> parse_files(span<const std::filesystem::path> files,
+                                             const parse_options &options = {},
+                                             size_t threads = 0)
+{
+    threads = threads ? threads : thread_pool::hardware_threads();
+    thread_pool pool{std::max<size_t>(1, std::min(threads, files.size()))};
+    return parse_files(files, options, pool);
+}
 
-    std::istream &input_;
-    std::string line_;
-    std::size_t line_number_ = 0;
+struct parsed_file
+{
+    std::filesystem::path path;
+    parse_result result;
 };
 
-inline parse_result parse_file(const std::string &file_path)
+/**
+ * Parses every `.toml` file below a directory, recursively, see
+ * parse_files().
+ * @return the results ordered by path
+ * @throw std::filesystem::filesystem_error if the directory cannot be read
+ */
+inline std::vector<parsed_file> parse_directory(const std::filesystem::path &directory,
+                                                const parse_options &options = {},
+                                                size_t threads = 0)
 {
-    std::ifstream file{file_path};
-
-    if (!file.is_open())
-    {
-        return {parse_error(file_path + " could not be opened for parsing")};
-    }
-    else
+    std::vector<std::filesystem::path> files;
+    for (const auto &entry : std::filesystem::recursive_directory_iterator{directory})
     {
-        try
-        {
-            parser p{file};
-            return {p.parse()};
-        }
-        catch (const parse_error &e)
+        if (entry.is_regular_file() && entry.path().extension() == ".toml")
         {
-            return {std::move(e)};
+            files.push_back(entry.path());
         }
     }
-}
+    std::sort(files.begin(), files.end());
 
-inline parse_result parse(const std::string &source)
-{
-    try
-    {
-        std::stringstream source_stream{source};
-        parser p{source_stream};
-        return {p.parse()};
-    }
-    catch (const parse_error &e)
+    auto results = parse_files(files, options, threads);
+
+    std::vector<parsed_file> parsed;
+    parsed.reserve(files.size());
+    for (size_t i = 0; i < files.size(); ++i)
     {
-        return {e};
+        parsed.push_back({std::move(files[i]), std::move(results[i])});
     }
+    return parsed;
 }
 TOML_NAMESPACE_END
 } // namespace toml
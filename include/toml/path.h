@@ -0,0 +1,246 @@
+#pragma once
+
+#include <stdexcept>
+#include <vector>
+
+#include "base.h"
+#include "key.h"
+#include "node_view.h"
+#include "scan.h"
+
+namespace toml
+{
+TOML_NAMESPACE_BEGIN
+
+/**
+ * A pre-split lookup path such as `database.ports[2]` or
+ * `servers."alpha.beta".ip`.
+ *
+ * Segments are separated by dots; a segment is a bare key, a basic ("...")
+ * or literal ('...') quoted key, and may be followed by any number of
+ * `[n]` array indices. Keys keep their hash, so evaluating a path against
+ * a document neither re-scans the text nor copies a shared_ptr per level.
+ * A path can be evaluated any number of times against any document.
+ */
+class path
+{
+    friend class node_ref;
+
+public:
+    struct segment
+    {
+        toml::key key;
+        size_t index{0};
+        bool is_index{false};
+    };
+
+    path() noexcept = default;
+
+    /**
+     * @throw std::invalid_argument if the path is malformed
+     */
+    explicit path(std::string_view text)
+    {
+        parse(text);
+    }
+
+    const std::vector<segment> &segments() const noexcept
+    {
+        return segments_;
+    }
+
+    size_t size() const noexcept
+    {
+        return segments_.size();
+    }
+
+    bool empty() const noexcept
+    {
+        return segments_.empty();
+    }
+
+private:
+    std::vector<segment> segments_;
+
+    [[noreturn]] static void throw_invalid(std::string_view text, const std::string &reason)
+    {
+        throw std::invalid_argument("invalid toml path \"" + std::string{text} + "\": " + reason);
+    }
+
+    void parse(std::string_view text)
+    {
+        auto it = text.begin();
+        auto end = text.end();
+
+        while (it != end)
+        {
+            if (*it == '"' || *it == '\'')
+            {
+                segments_.push_back({toml::key{parse_quoted(text, it, end)}});
+            }
+            else
+            {
+                auto start = it;
+                while (it != end && *it != '.' && *it != '[')
+                {
+                    if (!detail::is_class(*it, detail::cc_bare_key))
+                        throw_invalid(text, std::string{"unexpected character '"} + *it + "'");
+                    ++it;
+                }
+                // only a path into an array may start with an index
+                if (it == start && (it == end || *it != '[' || !segments_.empty()))
+                    throw_invalid(text, "empty key");
+                if (it != start)
+                    segments_.push_back({toml::key{std::string_view{&*start, static_cast<size_t>(it - start)}}});
+            }
+
+            while (it != end && *it == '[')
+            {
+                ++it;
+                size_t index = 0;
+                auto digits = it;
+                for (; it != end && *it >= '0' && *it <= '9'; ++it)
+                {
+                    index = index * 10 + static_cast<size_t>(*it - '0');
+                }
+                if (it == digits || it == end || *it != ']')
+                    throw_invalid(text, "array index must be a non-negative integer in []");
+                ++it;
+                segments_.push_back({toml::key{}, index, true});
+            }
+
+            if (it != end)
+            {
+                if (*it != '.')
+                    throw_invalid(text, "expected '.' or '['");
+                if (++it == end)
+                    throw_invalid(text, "trailing '.'");
+            }
+        }
+    }
+
+    static std::string parse_quoted(std::string_view text,
+                                    std::string_view::iterator &it,
+                                    std::string_view::iterator end)
+    {
+        char delim = *it++;
+        std::string result;
+        while (it != end && *it != delim)
+        {
+            if (delim == '"' && *it == '\\')
+            {
+                if (++it == end)
+                    break;
+                switch (*it)
+                {
+                case 'b':
+                    result += '\b';
+                    break;
+                case 't':
+                    result += '\t';
+                    break;
+                case 'n':
+                    result += '\n';
+                    break;
+                case 'f':
+                    result += '\f';
+                    break;
+                case 'r':
+                    result += '\r';
+                    break;
+                case '"':
+                case '\\':
+                    result += *it;
+                    break;
+                default:
+                    throw_invalid(text, std::string{"unknown escape \\"} + *it);
+                }
+                ++it;
+            }
+            else
+            {
+                result += *it++;
+            }
+        }
+        if (it == end)
+            throw_invalid(text, "unterminated quoted key");
+        ++it;
+        return result;
+    }
+};
+
+node_ref node_ref::operator[](const path &p) const
+{
+    if (slot_)
+    {
+        return child(find_slot(p));
+    }
+    else if (auto n = find_node(p))
+    {
+        return node_ref{*n};
+    }
+    else
+    {
+        return {};
+    }
+}
+
+bool node_ref::contains(const path &p) const
+{
+    return slot_ ? find_slot(p) != nullptr : find_node(p) != nullptr;
+}
+
+const node *node_ref::find_node(const path &p) const noexcept
+{
+    const node *current = node_;
+    for (const auto &seg : p.segments_)
+    {
+        if (!current)
+        {
+            return nullptr;
+        }
+        else if (seg.is_index)
+        {
+            if (!current->is<array>())
+                return nullptr;
+            const auto &elements = static_cast<const array &>(*current).get();
+            current = seg.index < elements.size() ? elements[seg.index].get() : nullptr;
+        }
+        else
+        {
+            if (!current->is<table>())
+                return nullptr;
+            const auto &tbl = static_cast<const table &>(*current);
+            auto it = tbl.find(seg.key);
+            current = it != tbl.end() ? it->second.get() : nullptr;
+        }
+    }
+    return current;
+}
+
+const document::slot *node_ref::find_slot(const path &p) const noexcept
+{
+    const document::slot *current = slot_;
+    for (const auto &seg : p.segments_)
+    {
+        if (!current)
+        {
+            return nullptr;
+        }
+        else if (seg.is_index)
+        {
+            bool is_array = current->type == base_type::Array ||
+                            current->type == base_type::TableArray;
+            current = is_array ? doc_->at(*current, seg.index) : nullptr;
+        }
+        else
+        {
+            current = current->type == base_type::Table ? doc_->find(*current, seg.key.view())
+                                                        : nullptr;
+        }
+    }
+    return current;
+}
+
+TOML_NAMESPACE_END
+} // namespace toml
@@ -0,0 +1,324 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#if !defined(TOML_NO_SIMD) && defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define TOML_SIMD_X86 1
+#else
+#define TOML_SIMD_X86 0
+#endif
+
+#include "base.h"
+
+namespace toml
+{
+TOML_NAMESPACE_BEGIN
+
+/**
+ * Character-class scanning used by the parser's hot loops.
+ *
+ * Long runs (indentation, string bodies, bare keys) are checked 16 bytes
+ * at a time with SSE2, or 32 at a time with AVX2 when the CPU supports it.
+ * The choice is made at runtime, so the library does not need to be built
+ * with -mavx2. Short tokens such as numbers and dates are classified through
+ * a lookup table instead. Define TOML_NO_SIMD to force the scalar code.
+ */
+namespace detail
+{
+enum char_class : uint8_t
+{
+    cc_whitespace = 1 << 0, // ' ' '\t'
+    cc_bare_key = 1 << 1,   // A-Z a-z 0-9 '_' '-'
+    cc_number = 1 << 2,     // 0-9 '_' '.' 'e' 'E' '-' '+' 'x' 'o' 'b'
+    cc_date = 1 << 3,       // 0-9 'T' 'Z' ':' '-' '+' '.'
+    cc_time = 1 << 4,       // 0-9 ':' '.'
+    cc_full_date = 1 << 5,  // 0-9 '-'
+    cc_escape = 1 << 6,     // '"' '\\' and control characters, escaped on output
+};
+
+struct char_class_table
+{
+    uint8_t classes[256]{};
+
+    constexpr char_class_table()
+    {
+        classes[static_cast<uint8_t>(' ')] |= cc_whitespace;
+        classes[static_cast<uint8_t>('\t')] |= cc_whitespace;
+
+        for (int c = 'A'; c <= 'Z'; ++c)
+            classes[c] |= cc_bare_key;
+        for (int c = 'a'; c <= 'z'; ++c)
+            classes[c] |= cc_bare_key;
+        for (int c = '0'; c <= '9'; ++c)
+            classes[c] |= cc_bare_key | cc_number | cc_date | cc_time | cc_full_date;
+        classes[static_cast<uint8_t>('_')] |= cc_bare_key | cc_number;
+        classes[static_cast<uint8_t>('-')] |= cc_bare_key | cc_number | cc_date | cc_full_date;
+
+        for (char c : {'.', 'e', 'E', '+', 'x', 'o', 'b'})
+            classes[static_cast<uint8_t>(c)] |= cc_number;
+        for (char c : {'T', 'Z', ':', '+', '.'})
+            classes[static_cast<uint8_t>(c)] |= cc_date;
+        for (char c : {':', '.'})
+            classes[static_cast<uint8_t>(c)] |= cc_time;
+
+        for (int c = 0; c < 0x20; ++c)
+            classes[c] |= cc_escape;
+        for (char c : {'"', '\\', '\x7f'})
+            classes[static_cast<uint8_t>(c)] |= cc_escape;
+    }
+};
+
+inline constexpr char_class_table char_classes{};
+
+inline bool is_class(char c, uint8_t mask) noexcept
+{
+    return (char_classes.classes[static_cast<uint8_t>(c)] & mask) != 0;
+}
+
+/**
+ * Returns the first position in [it, end) whose character is not in any
+ * of the classes in mask.
+ */
+inline const char *skip_class(const char *it, const char *end, uint8_t mask) noexcept
+{
+    while (it != end && is_class(*it, mask))
+        ++it;
+    return it;
+}
+
+#if TOML_SIMD_X86
+inline bool has_avx2() noexcept
+{
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+
+inline unsigned ctz(uint32_t mask) noexcept
+{
+    return static_cast<unsigned>(__builtin_ctz(mask));
+}
+
+// Block scanners: each returns the first byte that ends the scan, or the
+// start of the tail that is shorter than one block. Callers finish the
+// tail with the scalar loop.
+
+inline __m128i in_range(__m128i v, char lo, char hi) noexcept
+{
+    // bytes >= 0x80 compare as negative and so never fall in an ASCII range
+    return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(static_cast<char>(lo - 1))),
+                         _mm_cmplt_epi8(v, _mm_set1_epi8(static_cast<char>(hi + 1))));
+}
+
+inline const char *skip_whitespace_sse2(const char *it, const char *end) noexcept
+{
+    const auto space = _mm_set1_epi8(' ');
+    const auto tab = _mm_set1_epi8('\t');
+    for (; end - it >= 16; it += 16)
+    {
+        auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(it));
+        auto ws = _mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab));
+        auto mask = ~static_cast<uint32_t>(_mm_movemask_epi8(ws)) & 0xffffu;
+        if (mask != 0)
+            return it + ctz(mask);
+    }
+    return it;
+}
+
+inline const char *find_string_special_sse2(const char *it, const char *end, char delim) noexcept
+{
+    const auto quote = _mm_set1_epi8(delim);
+    const auto backslash = _mm_set1_epi8('\\');
+    for (; end - it >= 16; it += 16)
+    {
+        auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(it));
+        auto stop = _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash));
+        auto mask = static_cast<uint32_t>(_mm_movemask_epi8(stop));
+        if (mask != 0)
+            return it + ctz(mask);
+    }
+    return it;
+}
+
+inline const char *find_escape_sse2(const char *it, const char *end) noexcept
+{
+    const auto quote = _mm_set1_epi8('"');
+    const auto backslash = _mm_set1_epi8('\\');
+    const auto del = _mm_set1_epi8(0x7f);
+    for (; end - it >= 16; it += 16)
+    {
+        auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(it));
+        auto stop = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+                                 _mm_or_si128(_mm_cmpeq_epi8(v, del), in_range(v, 0, 0x1f)));
+        auto mask = static_cast<uint32_t>(_mm_movemask_epi8(stop));
+        if (mask != 0)
+            return it + ctz(mask);
+    }
+    return it;
+}
+
+inline const char *find_bare_key_end_sse2(const char *it, const char *end) noexcept
+{
+    const auto lower = _mm_set1_epi8(0x20);
+    const auto underscore = _mm_set1_epi8('_');
+    const auto dash = _mm_set1_epi8('-');
+    for (; end - it >= 16; it += 16)
+    {
+        auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(it));
+        auto alpha = in_range(_mm_or_si128(v, lower), 'a', 'z');
+        auto digit = in_range(v, '0', '9');
+        auto punct = _mm_or_si128(_mm_cmpeq_epi8(v, underscore), _mm_cmpeq_epi8(v, dash));
+        auto ok = _mm_or_si128(_mm_or_si128(alpha, digit), punct);
+        auto mask = ~static_cast<uint32_t>(_mm_movemask_epi8(ok)) & 0xffffu;
+        if (mask != 0)
+            return it + ctz(mask);
+    }
+    return it;
+}
+
+__attribute__((target("avx2"))) inline __m256i in_range(__m256i v, char lo, char hi) noexcept
+{
+    return _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(static_cast<char>(lo - 1))),
+                            _mm256_cmpgt_epi8(_mm256_set1_epi8(static_cast<char>(hi + 1)), v));
+}
+
+__attribute__((target("avx2"))) inline const char *skip_whitespace_avx2(const char *it,
+                                                                        const char *end) noexcept
+{
+    const auto space = _mm256_set1_epi8(' ');
+    const auto tab = _mm256_set1_epi8('\t');
+    for (; end - it >= 32; it += 32)
+    {
+        auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(it));
+        auto ws = _mm256_or_si256(_mm256_cmpeq_epi8(v, space), _mm256_cmpeq_epi8(v, tab));
+        auto mask = ~static_cast<uint32_t>(_mm256_movemask_epi8(ws));
+        if (mask != 0)
+            return it + ctz(mask);
+    }
+    return it;
+}
+
+__attribute__((target("avx2"))) inline const char *find_string_special_avx2(const char *it,
+                                                                            const char *end,
+                                                                            char delim) noexcept
+{
+    const auto quote = _mm256_set1_epi8(delim);
+    const auto backslash = _mm256_set1_epi8('\\');
+    for (; end - it >= 32; it += 32)
+    {
+        auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(it));
+        auto stop = _mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash));
+        auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(stop));
+        if (mask != 0)
+            return it + ctz(mask);
+    }
+    return it;
+}
+
+__attribute__((target("avx2"))) inline const char *find_escape_avx2(const char *it,
+                                                                    const char *end) noexcept
+{
+    const auto quote = _mm256_set1_epi8('"');
+    const auto backslash = _mm256_set1_epi8('\\');
+    const auto del = _mm256_set1_epi8(0x7f);
+    for (; end - it >= 32; it += 32)
+    {
+        auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(it));
+        auto stop = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, del), in_range(v, 0, 0x1f)));
+        auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(stop));
+        if (mask != 0)
+            return it + ctz(mask);
+    }
+    return it;
+}
+
+__attribute__((target("avx2"))) inline const char *find_bare_key_end_avx2(const char *it,
+                                                                          const char *end) noexcept
+{
+    const auto lower = _mm256_set1_epi8(0x20);
+    const auto underscore = _mm256_set1_epi8('_');
+    const auto dash = _mm256_set1_epi8('-');
+    for (; end - it >= 32; it += 32)
+    {
+        auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(it));
+        auto alpha = in_range(_mm256_or_si256(v, lower), 'a', 'z');
+        auto digit = in_range(v, '0', '9');
+        auto punct = _mm256_or_si256(_mm256_cmpeq_epi8(v, underscore),
+                                     _mm256_cmpeq_epi8(v, dash));
+        auto ok = _mm256_or_si256(_mm256_or_si256(alpha, digit), punct);
+        auto mask = ~static_cast<uint32_t>(_mm256_movemask_epi8(ok));
+        if (mask != 0)
+            return it + ctz(mask);
+    }
+    return it;
+}
+#endif
+
+/**
+ * Skips spaces and tabs.
+ */
+inline const char *skip_whitespace(const char *it, const char *end) noexcept
+{
+    // most runs are a single separating space: avoid the vector setup
+    if (it == end || !is_class(*it, cc_whitespace))
+        return it;
+
+#if TOML_SIMD_X86
+    if (has_avx2())
+        it = skip_whitespace_avx2(it, end);
+    it = skip_whitespace_sse2(it, end);
+#endif
+    return skip_class(it, end, cc_whitespace);
+}
+
+/**
+ * Finds the end of a run of plain string characters: the first delim or
+ * backslash in [it, end).
+ */
+inline const char *find_string_special(const char *it, const char *end, char delim) noexcept
+{
+#if TOML_SIMD_X86
+    if (has_avx2())
+        it = find_string_special_avx2(it, end, delim);
+    it = find_string_special_sse2(it, end, delim);
+#endif
+    while (it != end && *it != delim && *it != '\\')
+        ++it;
+    return it;
+}
+
+/**
+ * Finds the first character in [it, end) that must be escaped in a basic
+ * string.
+ */
+inline const char *find_escape(const char *it, const char *end) noexcept
+{
+#if TOML_SIMD_X86
+    if (has_avx2())
+        it = find_escape_avx2(it, end);
+    it = find_escape_sse2(it, end);
+#endif
+    while (it != end && !is_class(*it, cc_escape))
+        ++it;
+    return it;
+}
+
+/**
+ * Finds the first character in [it, end) that may not appear in a bare key.
+ */
+inline const char *find_bare_key_end(const char *it, const char *end) noexcept
+{
+#if TOML_SIMD_X86
+    if (has_avx2())
+        it = find_bare_key_end_avx2(it, end);
+    it = find_bare_key_end_sse2(it, end);
+#endif
+    return skip_class(it, end, cc_bare_key);
+}
+} // namespace detail
+
+TOML_NAMESPACE_END
+} // namespace toml
@@ -0,0 +1,233 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#include "base.h"
+#include "document.h"
+#include "node_ref.h"
+#include "node_view.h"
+
+namespace toml
+{
+TOML_NAMESPACE_BEGIN
+
+/**
+ * An immutable document that can be shared freely between threads.
+ *
+ * Snapshots are stored as compact documents, so nothing reachable from
+ * one can be modified after it has been published.
+ */
+class snapshot
+{
+public:
+    snapshot() noexcept = default;
+
+    /**
+     * Freezes a parsed document. Compact views share their document; node
+     * trees are copied into a new compact document.
+     * @throw std::invalid_argument if the view is not a table
+     */
+    explicit snapshot(const node_view &view)
+    {
+        if (view.is_compact())
+        {
+            doc_ = view.doc_;
+            root_ = view.slot_;
+        }
+        else if (view.is_table())
+        {
+            doc_ = make_document(static_cast<const table &>(view.get()));
+            root_ = &doc_->root();
+        }
+        else
+        {
+            throw std::invalid_argument("a snapshot must be made of a table");
+        }
+    }
+
+    explicit operator bool() const noexcept
+    {
+        return doc_ != nullptr;
+    }
+
+    /**
+     * A borrowed handle to the root table, valid while this snapshot is.
+     */
+    node_ref root() const noexcept
+    {
+        return doc_ ? node_ref{*doc_, *root_} : node_ref{};
+    }
+
+    /**
+     * An owning view of the root table.
+     */
+    node_view view() const noexcept
+    {
+        return doc_ ? node_view{doc_, root_} : node_view{nullptr};
+    }
+
+private:
+    std::shared_ptr<const document> doc_;
+    const document::slot *root_{nullptr};
+};
+
+/**
+ * Publishes the current snapshot of a configuration to any number of
+ * reader threads while a writer replaces it.
+ *
+ * Readers never block: read() announces the reader on one of a few
+ * cache-line-sized counters and loads the current snapshot, and the
+ * returned guard withdraws the announcement. store() swaps the snapshot
+ * and then waits for a grace period, i.e. for every reader that may still
+ * see the old snapshot to drop its guard, before releasing it. Readers
+ * therefore see either the old or the new document, never a partial one.
+ */
+class snapshot_slot
+{
+    struct alignas(64) reader_stripe
+    {
+        std::atomic<uint64_t> readers[2]{};
+    };
+
+    static constexpr size_t stripe_count = 16;
+
+public:
+    /**
+     * The snapshot seen by one reader, pinned until the guard is destroyed.
+     * Guards are meant to be short-lived (e.g. one request); hold on to a
+     * snapshot from load() for anything longer.
+     */
+    class read_guard
+    {
+        friend class snapshot_slot;
+
+    public:
+        read_guard(read_guard &&other) noexcept
+            : counter_(other.counter_),
+              snapshot_(other.snapshot_)
+        {
+            other.counter_ = nullptr;
+        }
+
+        read_guard(const read_guard &) = delete;
+        read_guard &operator=(const read_guard &) = delete;
+        read_guard &operator=(read_guard &&) = delete;
+
+        ~read_guard()
+        {
+            if (counter_)
+            {
+                counter_->fetch_sub(1, std::memory_order_release);
+            }
+        }
+
+        const snapshot &operator*() const noexcept
+        {
+            return *snapshot_;
+        }
+
+        const snapshot *operator->() const noexcept
+        {
+            return snapshot_;
+        }
+
+        node_ref root() const noexcept
+        {
+            return snapshot_->root();
+        }
+
+    private:
+        std::atomic<uint64_t> *counter_;
+        const snapshot *snapshot_;
+
+        read_guard(std::atomic<uint64_t> *counter, const snapshot *s) noexcept
+            : counter_(counter),
+              snapshot_(s) {}
+    };
+
+    snapshot_slot()
+        : current_(new snapshot{}) {}
+
+    explicit snapshot_slot(snapshot initial)
+        : current_(new snapshot{std::move(initial)}) {}
+
+    snapshot_slot(const snapshot_slot &) = delete;
+    snapshot_slot &operator=(const snapshot_slot &) = delete;
+
+    ~snapshot_slot()
+    {
+        delete current_.load();
+    }
+
+    /**
+     * Pins the current snapshot. Wait-free.
+     */
+    read_guard read() const noexcept
+    {
+        auto &stripe = stripes_[stripe_index()];
+        auto &counter = stripe.readers[epoch_.load(std::memory_order_seq_cst)];
+        counter.fetch_add(1, std::memory_order_seq_cst);
+        return read_guard{&counter, current_.load(std::memory_order_seq_cst)};
+    }
+
+    /**
+     * A copy of the current snapshot, which keeps its document alive on
+     * its own.
+     */
+    snapshot load() const
+    {
+        return *read();
+    }
+
+    /**
+     * Publishes a new snapshot. Blocks until no reader can still see the
+     * previous one; concurrent calls are serialized.
+     */
+    void store(snapshot next)
+    {
+        std::lock_guard<std::mutex> lock{writer_mutex_};
+        auto previous = current_.exchange(new snapshot{std::move(next)}, std::memory_order_seq_cst);
+        synchronize();
+        delete previous;
+    }
+
+private:
+    mutable reader_stripe stripes_[stripe_count];
+    std::atomic<unsigned> epoch_{0};
+    std::atomic<const snapshot *> current_;
+    std::mutex writer_mutex_;
+
+    static size_t stripe_index() noexcept
+    {
+        static thread_local const size_t index =
+            std::hash<std::thread::id>{}(std::this_thread::get_id()) % stripe_count;
+        return index;
+    }
+
+    /**
+     * Waits for a grace period. A reader may read the epoch just before a
+     * flip and announce itself after the wait for that epoch has passed,
+     * so the epoch is flipped twice, waiting out the readers of each.
+     */
+    void synchronize() noexcept
+    {
+        for (int round = 0; round < 2; ++round)
+        {
+            auto epoch = epoch_.load(std::memory_order_relaxed);
+            epoch_.store(epoch ^ 1, std::memory_order_seq_cst);
+            for (auto &stripe : stripes_)
+            {
+                while (stripe.readers[epoch].load(std::memory_order_acquire) != 0)
+                {
+                    std::this_thread::yield();
+                }
+            }
+        }
+    }
+};
+
+TOML_NAMESPACE_END
+} // namespace toml
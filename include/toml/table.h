@@ -1,11 +1,20 @@
 #pragma once
 
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "array.h"
 #include "base.h"
+#include "key.h"
 #include "node.h"
 
 namespace toml
 {
 TOML_NAMESPACE_BEGIN
+
 /**
  * Represents a TOML keytable.
  */
@@ -14,58 +23,164 @@ class table final : public node
     struct make_shared_enabler
     {
     };
-    friend std::shared_ptr<table> make_table(bool is_inline);
+
+    friend std::shared_ptr<table> make_table(bool is_inline, table_storage storage);
+    template <class Alloc>
+    friend std::shared_ptr<table> allocate_table(const Alloc &alloc, bool is_inline,
+                                                 table_storage storage);
 
 public:
-    using map = std::map<std::string, std::shared_ptr<node>, std::less<>>;
+    using map = std::pmr::map<toml::key, std::shared_ptr<node>, key_less>;
+    using entry = map::value_type;
 
-    using key_type = std::string;
+    using key_type = toml::key;
     using value_type = std::shared_ptr<node>;
     using size_type = size_t;
 
-    using iterator = map::iterator;
-    using const_iterator = map::const_iterator;
+    /**
+     * Iterates either storage. Iterators into hashed tables are invalidated
+     * by insertion and erasure, like those of a vector.
+     */
+    template <bool IsConst>
+    class basic_iterator
+    {
+        friend class table;
+
+        using map_iterator = std::conditional_t<IsConst, map::const_iterator, map::iterator>;
+        using entry_pointer = std::conditional_t<IsConst, const entry *, entry *>;
+
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = entry;
+        using difference_type = ptrdiff_t;
+        using reference = std::conditional_t<IsConst, const entry &, entry &>;
+        using pointer = entry_pointer;
 
-    table(const make_shared_enabler &, bool is_inline) noexcept
+        basic_iterator() noexcept = default;
+
+        template <bool C = IsConst, typename = std::enable_if_t<C>>
+        basic_iterator(const basic_iterator<false> &other) noexcept
+            : map_it_(other.map_it_),
+              entry_(other.entry_),
+              flat_(other.flat_) {}
+
+        reference operator*() const noexcept
+        {
+            return flat_ ? *entry_ : *map_it_;
+        }
+
+        pointer operator->() const noexcept
+        {
+            return &**this;
+        }
+
+        basic_iterator &operator++() noexcept
+        {
+            if (flat_)
+                ++entry_;
+            else
+                ++map_it_;
+            return *this;
+        }
+
+        basic_iterator operator++(int) noexcept
+        {
+            auto result = *this;
+            ++*this;
+            return result;
+        }
+
+        basic_iterator &operator--() noexcept
+        {
+            if (flat_)
+                --entry_;
+            else
+                --map_it_;
+            return *this;
+        }
+
+        basic_iterator operator--(int) noexcept
+        {
+            auto result = *this;
+            --*this;
+            return result;
+        }
+
+        friend bool operator==(const basic_iterator &lhs, const basic_iterator &rhs) noexcept
+        {
+            return lhs.flat_ ? lhs.entry_ == rhs.entry_ : lhs.map_it_ == rhs.map_it_;
+        }
+
+        friend bool operator!=(const basic_iterator &lhs, const basic_iterator &rhs) noexcept
+        {
+            return !(lhs == rhs);
+        }
+
+    private:
+        friend class basic_iterator<true>;
+
+        map_iterator map_it_{};
+        entry_pointer entry_{nullptr};
+        bool flat_{false};
+
+        basic_iterator(map_iterator it) noexcept
+            : map_it_(it) {}
+
+        basic_iterator(entry_pointer e) noexcept
+            : entry_(e),
+              flat_(true) {}
+    };
+
+    using iterator = basic_iterator<false>;
+    using const_iterator = basic_iterator<true>;
+
+    table(const make_shared_enabler &, bool is_inline,
+          std::pmr::memory_resource *resource = std::pmr::get_default_resource(),
+          table_storage storage = table_storage::ordered) noexcept
         : node(base_type::Table),
-          is_inline_(is_inline) {}
+          map_(resource),
+          entries_(resource),
+          index_(resource),
+          is_inline_(is_inline),
+          storage_(storage) {}
 
     std::shared_ptr<node> clone() const override
     {
-        auto result = make_table();
-        for (const auto &pr : map_)
+        auto result = make_table(is_inline_, storage_);
+        for (const auto &pr : *this)
             result->emplace(pr.first, pr.second->clone());
         return result;
     }
 
     iterator begin() noexcept
     {
-        return map_.begin();
+        return is_hashed() ? iterator{entries_.data()} : iterator{map_.begin()};
     }
 
     const_iterator begin() const noexcept
     {
-        return map_.begin();
+        return is_hashed() ? const_iterator{entries_.data()} : const_iterator{map_.begin()};
     }
 
     const_iterator cbegin() const noexcept
     {
-        return map_.cbegin();
+        return begin();
     }
 
     iterator end() noexcept
     {
-        return map_.end();
+        return is_hashed() ? iterator{entries_.data() + entries_.size()} : iterator{map_.end()};
     }
 
     const_iterator end() const noexcept
     {
-        return map_.end();
+        return is_hashed() ? const_iterator{entries_.data() + entries_.size()}
+                           : const_iterator{map_.end()};
     }
 
     const_iterator cend() const noexcept
     {
-        return map_.cend();
+        return end();
     }
 
     bool is_inline() const noexcept
@@ -73,21 +188,34 @@ public:
         return is_inline_;
     }
 
+    table_storage storage() const noexcept
+    {
+        return storage_;
+    }
+
     bool empty() const noexcept
     {
-        return map_.empty();
+        return is_hashed() ? entries_.empty() : map_.empty();
     }
 
     size_t size() const noexcept
     {
-        return map_.size();
+        return is_hashed() ? entries_.size() : map_.size();
     }
 
     bool contains(std::string_view key) const
     {
-        return map_.find(key) != map_.end();
+        return find(key) != end();
+    }
+
+    bool contains(const toml::key &key) const
+    {
+        return find(key) != end();
     }
 
+    /**
+     * The underlying map of an ordered table (always empty for hashed ones).
+     */
     map &get() noexcept
     {
         return map_;
@@ -100,7 +228,19 @@ public:
 
     std::shared_ptr<node> at(std::string_view key)
     {
-        if (auto it = map_.find(key); it != map_.end())
+        if (auto it = find(key); it != end())
+        {
+            return it->second;
+        }
+        else
+        {
+            return nullptr;
+        }
+    }
+
+    std::shared_ptr<node> at(const toml::key &key)
+    {
+        if (auto it = find(key); it != end())
         {
             return it->second;
         }
@@ -112,7 +252,19 @@ public:
 
     std::shared_ptr<const node> at(std::string_view key) const
     {
-        if (auto it = map_.find(key); it != map_.end())
+        if (auto it = find(key); it != end())
+        {
+            return it->second;
+        }
+        else
+        {
+            return nullptr;
+        }
+    }
+
+    std::shared_ptr<const node> at(const toml::key &key) const
+    {
+        if (auto it = find(key); it != end())
         {
             return it->second;
         }
@@ -124,25 +276,80 @@ public:
 
     iterator find(std::string_view key)
     {
-        return map_.find(key);
+        if (is_hashed())
+        {
+            auto pos = find_entry(key, detail::hash_key(key));
+            return iterator{entries_.data() + (pos == npos ? entries_.size() : pos)};
+        }
+        return iterator{map_.find(key)};
     }
 
     const_iterator find(std::string_view key) const
     {
-        return map_.find(key);
+        return const_cast<table *>(this)->find(key);
+    }
+
+    /**
+     * Looks up an interned key: hashed tables reuse its hash and compare
+     * keys from the same pool by address.
+     */
+    iterator find(const toml::key &key)
+    {
+        if (is_hashed())
+        {
+            auto pos = find_entry(key, key.hash());
+            return iterator{entries_.data() + (pos == npos ? entries_.size() : pos)};
+        }
+        return iterator{map_.find(key.view())};
+    }
+
+    const_iterator find(const toml::key &key) const
+    {
+        return const_cast<table *>(this)->find(key);
     }
 
     // this will overwrite existing node
     template <typename K, typename V, typename = std::enable_if_t<std::is_convertible_v<K &&, std::string_view>>>
     std::pair<iterator, bool> insert_or_assign(K &&key, V &&val) noexcept
     {
-        return map_.insert_or_assign(std::forward<K>(key), std::forward<V>(val));
+        if (is_hashed())
+        {
+            if (auto it = find(key); it != end())
+            {
+                it->second = std::forward<V>(val);
+                return {it, false};
+            }
+            return {append(std::forward<K>(key), std::forward<V>(val)), true};
+        }
+        auto ipos = map_.lower_bound(key);
+        if (ipos == map_.end() || ipos->first != key)
+        {
+            return {iterator{map_.emplace_hint(ipos, std::forward<K>(key), std::forward<V>(val))}, true};
+        }
+        ipos->second = std::forward<V>(val);
+        return {iterator{ipos}, false};
     }
 
     // this will not overwrite existing node
     template <typename K, typename V, typename = std::enable_if_t<std::is_convertible_v<K &&, std::string_view>>>
     std::pair<iterator, bool> emplace(K &&key, V &&val)
     {
+        if (is_hashed())
+        {
+            if (auto it = find(key); it != end())
+            {
+                return {it, false};
+            }
+            if constexpr (is_value_promotable<V>)
+            {
+                return {append(std::forward<K>(key), make_value(std::forward<V>(val))), true};
+            }
+            else
+            {
+                return {append(std::forward<K>(key), std::forward<V>(val)), true};
+            }
+        }
+
         auto ipos = map_.lower_bound(key);
         if (ipos == map_.end() || ipos->first != key)
         {
@@ -154,26 +361,32 @@ public:
             {
                 ipos = map_.emplace_hint(ipos, std::forward<K>(key), std::forward<V>(val));
             }
-            return {ipos, true};
+            return {iterator{ipos}, true};
         }
-        return {ipos, false};
+        return {iterator{ipos}, false};
     }
 
     iterator erase(iterator pos)
     {
-        return map_.erase(pos);
+        return erase(const_iterator{pos});
     }
 
     iterator erase(const_iterator pos)
     {
-        return map_.erase(pos);
+        if (is_hashed())
+        {
+            auto index = static_cast<size_t>(pos.entry_ - entries_.data());
+            remove_entry(index);
+            return iterator{entries_.data() + index};
+        }
+        return iterator{map_.erase(pos.map_it_)};
     }
 
     bool erase(std::string_view key)
     {
-        if (auto it = map_.find(key); it != map_.end())
+        if (auto it = find(key); it != end())
         {
-            map_.erase(it);
+            erase(it);
             return true;
         }
         else
@@ -183,8 +396,22 @@ public:
     }
 
 private:
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+    /// Hashed tables with at most this many entries are searched linearly.
+    static constexpr size_t linear_limit = 8;
+
+    struct bucket
+    {
+        uint32_t tag;      // low bits of the key's hash
+        uint32_t position; // entry index + 1, 0 if empty
+    };
+
     map map_;
+    std::pmr::vector<entry> entries_;
+    std::pmr::vector<bucket> index_;
     bool is_inline_{false};
+    table_storage storage_{table_storage::ordered};
 
     table(bool is_inline)
         : node(base_type::Table),
@@ -192,11 +419,178 @@ private:
 
     table(const table &obj) = delete;
     table &operator=(const table &rhs) = delete;
+
+    bool is_hashed() const noexcept
+    {
+        return storage_ == table_storage::hashed;
+    }
+
+    template <class K>
+    size_t find_entry(const K &key, size_t h) const noexcept
+    {
+        if (index_.empty())
+        {
+            for (size_t i = 0; i < entries_.size(); ++i)
+            {
+                if (entries_[i].first == key)
+                {
+                    return i;
+                }
+            }
+            return npos;
+        }
+
+        auto tag = static_cast<uint32_t>(h);
+        auto mask = index_.size() - 1;
+        for (auto i = h & mask;; i = (i + 1) & mask)
+        {
+            const auto &b = index_[i];
+            if (b.position == 0)
+            {
+                return npos;
+            }
+            if (b.tag == tag && entries_[b.position - 1].first == key)
+            {
+                return b.position - 1;
+            }
+        }
+    }
+
+    void insert_index(size_t position) noexcept
+    {
+        auto h = entries_[position].first.hash();
+        auto mask = index_.size() - 1;
+        auto i = h & mask;
+        while (index_[i].position != 0)
+        {
+            i = (i + 1) & mask;
+        }
+        index_[i] = {static_cast<uint32_t>(h), static_cast<uint32_t>(position + 1)};
+    }
+
+    void rebuild_index()
+    {
+        index_.clear();
+        if (entries_.size() <= linear_limit)
+        {
+            return;
+        }
+
+        // keep the load factor at or below one half
+        size_t capacity = 16;
+        while (capacity < 2 * entries_.size())
+        {
+            capacity *= 2;
+        }
+        index_.assign(capacity, bucket{0, 0});
+        for (size_t i = 0; i < entries_.size(); ++i)
+        {
+            insert_index(i);
+        }
+    }
+
+    template <typename K, typename V>
+    iterator append(K &&key, V &&val)
+    {
+        entries_.emplace_back(std::forward<K>(key), std::forward<V>(val));
+        if (index_.empty() ? entries_.size() > linear_limit : 2 * entries_.size() > index_.size())
+        {
+            rebuild_index();
+        }
+        else if (!index_.empty())
+        {
+            insert_index(entries_.size() - 1);
+        }
+        return iterator{&entries_.back()};
+    }
+
+    /**
+     * Drops an entry from the index by backward-shift deletion, so that no
+     * probe sequence is broken, and renumbers the entries after it.
+     */
+    void unindex(size_t position) noexcept
+    {
+        auto mask = index_.size() - 1;
+        auto i = entries_[position].first.hash() & mask;
+        while (index_[i].position != position + 1)
+        {
+            i = (i + 1) & mask;
+        }
+        for (auto j = (i + 1) & mask; index_[j].position != 0; j = (j + 1) & mask)
+        {
+            // move bucket j into the hole unless the hole lies before its home
+            auto home = index_[j].tag & mask;
+            if (((j - home) & mask) >= ((j - i) & mask))
+            {
+                index_[i] = index_[j];
+                i = j;
+            }
+        }
+        index_[i] = bucket{0, 0};
+
+        for (auto &b : index_)
+        {
+            if (b.position > position + 1)
+            {
+                --b.position;
+            }
+        }
+    }
+
+    void remove_entry(size_t position) noexcept
+    {
+        if (!index_.empty())
+        {
+            unindex(position);
+        }
+
+        // keys are const, so the entries after position are shifted down by
+        // reconstructing each in place of its predecessor; nothing is
+        // allocated, which matters for tables in an arena
+        for (auto i = position; i + 1 < entries_.size(); ++i)
+        {
+            std::destroy_at(&entries_[i]);
+            ::new (static_cast<void *>(&entries_[i])) entry(std::move(entries_[i + 1]));
+        }
+        entries_.pop_back();
+    }
 };
 
-std::shared_ptr<table> make_table(bool is_inline)
+std::shared_ptr<table> make_table(bool is_inline, table_storage storage)
+{
+    return std::make_shared<table>(table::make_shared_enabler{}, is_inline,
+                                   std::pmr::get_default_resource(), storage);
+}
+
+template <class Alloc>
+std::shared_ptr<table> allocate_table(const Alloc &alloc, bool is_inline, table_storage storage)
+{
+    return std::allocate_shared<table>(alloc, table::make_shared_enabler{}, is_inline,
+                                       detail::allocator_resource<Alloc>::get(alloc), storage);
+}
+
+uint16_t array::add_to_summary(uint16_t summary, const node &n) noexcept
 {
-    return std::make_shared<table>(table::make_shared_enabler{}, is_inline);
+    auto type = n.is<array>() ? base_type::Array : n.type();
+    if (type == base_type::Table && static_cast<const table &>(n).is_inline())
+    {
+        summary |= summary_inline_table;
+    }
+
+    if (summary & summary_mixed)
+    {
+        return summary;
+    }
+    else if ((summary & summary_type_mask) == static_cast<uint16_t>(base_type::None))
+    {
+        return static_cast<uint16_t>(summary | static_cast<uint16_t>(type));
+    }
+    else if ((summary & summary_type_mask) != static_cast<uint16_t>(type))
+    {
+        return static_cast<uint16_t>((summary & ~summary_type_mask) | summary_mixed);
+    }
+    return summary;
 }
+
 TOML_NAMESPACE_END
-} // namespace toml
\ No newline at end of file
+} // namespace toml
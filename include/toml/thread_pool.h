@@ -0,0 +1,214 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "base.h"
+
+namespace toml
+{
+TOML_NAMESPACE_BEGIN
+
+/**
+ * A fixed set of worker threads running batches of independent tasks.
+ *
+ * A batch is dealt out round-robin into one queue per thread, the thread
+ * calling run() included. Each thread takes tasks from the front of its
+ * own queue and, once that runs dry, steals from the back of the others',
+ * so a few long tasks do not leave the remaining threads idle.
+ */
+class thread_pool
+{
+    struct alignas(64) work_queue
+    {
+        std::mutex mutex;
+        std::deque<size_t> tasks;
+    };
+
+public:
+    /**
+     * @param threads the number of threads running a batch, including the
+     *        one calling run(); 0 for one per hardware thread
+     */
+    explicit thread_pool(size_t threads = 0)
+        : size_(threads ? threads : hardware_threads()),
+          queues_(new work_queue[size_])
+    {
+        workers_.reserve(size_ - 1);
+        for (size_t i = 1; i < size_; ++i)
+        {
+            workers_.emplace_back([this, i]
+                                  { work(i); });
+        }
+    }
+
+    thread_pool(const thread_pool &) = delete;
+    thread_pool &operator=(const thread_pool &) = delete;
+
+    ~thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (auto &worker : workers_)
+        {
+            worker.join();
+        }
+    }
+
+    static size_t hardware_threads() noexcept
+    {
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    size_t size() const noexcept
+    {
+        return size_;
+    }
+
+    /**
+     * Calls task(i) for every i in [0, count) and waits for all of them.
+     * Batches submitted from several threads run one after the other.
+     * @throw the first exception thrown by a task, once all have finished
+     */
+    template <class F>
+    void run(size_t count, F &&task)
+    {
+        if (count == 0)
+        {
+            return;
+        }
+
+        std::lock_guard<std::mutex> batch{batch_mutex_};
+        task_ = [&task](size_t i)
+        { task(i); };
+        for (size_t i = 0; i < count; ++i)
+        {
+            queues_[i % size_].tasks.push_back(i);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            ++generation_;
+            busy_ = workers_.size();
+        }
+        wake_.notify_all();
+
+        drain(0);
+
+        std::unique_lock<std::mutex> lock{mutex_};
+        done_.wait(lock, [this]
+                   { return busy_ == 0; });
+        task_ = nullptr;
+        if (auto error = std::exchange(error_, nullptr))
+        {
+            std::rethrow_exception(error);
+        }
+    }
+
+private:
+    size_t size_;
+    std::unique_ptr<work_queue[]> queues_;
+    std::vector<std::thread> workers_;
+    std::function<void(size_t)> task_;
+    std::exception_ptr error_;
+    std::mutex batch_mutex_;
+    std::mutex mutex_; // guards generation_, busy_, stop_ and error_
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    uint64_t generation_{0};
+    size_t busy_{0};
+    bool stop_{false};
+
+    void work(size_t self)
+    {
+        uint64_t seen = 0;
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock{mutex_};
+                wake_.wait(lock, [&]
+                           { return stop_ || generation_ != seen; });
+                if (stop_)
+                {
+                    return;
+                }
+                seen = generation_;
+            }
+
+            drain(self);
+
+            std::lock_guard<std::mutex> lock{mutex_};
+            if (--busy_ == 0)
+            {
+                done_.notify_all();
+            }
+        }
+    }
+
+    /**
+     * Runs tasks until every queue is empty. No task is queued while a
+     * batch runs, so a queue found empty stays empty.
+     */
+    void drain(size_t self)
+    {
+        size_t task;
+        while (pop(self, task) || steal(self, task))
+        {
+            try
+            {
+                task_(task);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock{mutex_};
+                if (!error_)
+                {
+                    error_ = std::current_exception();
+                }
+            }
+        }
+    }
+
+    bool pop(size_t self, size_t &task)
+    {
+        auto &queue = queues_[self];
+        std::lock_guard<std::mutex> lock{queue.mutex};
+        if (queue.tasks.empty())
+        {
+            return false;
+        }
+        task = queue.tasks.front();
+        queue.tasks.pop_front();
+        return true;
+    }
+
+    bool steal(size_t self, size_t &task)
+    {
+        for (size_t i = 1; i < size_; ++i)
+        {
+            auto &queue = queues_[(self + i) % size_];
+            std::lock_guard<std::mutex> lock{queue.mutex};
+            if (!queue.tasks.empty())
+            {
+                task = queue.tasks.back();
+                queue.tasks.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+TOML_NAMESPACE_END
+} // namespace toml
@@ -30,6 +30,19 @@ enum class base_type : uint8_t
     TableArray,
 };
 
+/**
+ * How a table stores its entries.
+ */
+enum class table_storage : uint8_t
+{
+    /// A map sorted by key: O(log n) lookups, iteration in key order.
+    ordered,
+    /// A vector of entries in insertion (document) order, indexed by a hash
+    /// table on the key once the table grows past a few entries: O(1)
+    /// lookups and contiguous iteration.
+    hashed,
+};
+
 struct local_date;
 struct local_time;
 struct local_date_time;
@@ -39,8 +52,13 @@ struct offset_date_time;
 class array;
 class table;
 
+class key;
 class node;
 class node_view;
+class node_ref;
+class path;
+class snapshot;
+class document;
 
 template <typename T>
 class value;
@@ -50,11 +68,23 @@ TOML_NAMESPACE_END
 } // namespace toml
 
 #include "base.h"
+#include "arena.h"
+#include "key.h"
 #include "date_time.h"
 #include "node.h"
 #include "value.h"
 #include "array.h"
 #include "table.h"
+#include "document.h"
+#include "node_ref.h"
 #include "node_view.h"
+#include "path.h"
+#include "snapshot.h"
+#include "mapped_file.h"
+#include "scan.h"
+#include "thread_pool.h"
+#include "event_parser.h"
 #include "parser.h"
-#include "writer.h"
\ No newline at end of file
+#include "cache.h"
+#include "writer.h"
+#include "bind.h"
\ No newline at end of file
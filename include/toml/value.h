@@ -10,7 +10,7 @@ TOML_NAMESPACE_BEGIN
  * A concrete TOML value representing the "leaves" of the "tree".
  */
 template <class T>
-class value final : public node
+class value : public node
 {
     struct make_shared_enabler
     {
@@ -19,13 +19,16 @@ class value final : public node
     template <class U>
     friend std::shared_ptr<value<typename value_type_traits<U>::base_type>> make_value(U &&val);
 
+    template <class Alloc, class U>
+    friend std::shared_ptr<value<typename value_type_traits<U>::base_type>> allocate_value(const Alloc &alloc, U &&val);
+
     static_assert(toml::is_value<T>, "Template type parameter must be one of the TOML value types");
 
 public:
     std::shared_ptr<node> clone() const override
     {
         // just make a copy of original data_
-        return make_value(T(data_));
+        return make_value(T(get()));
     }
 
     value(const make_shared_enabler &, const T &val)
@@ -33,15 +36,19 @@ public:
 
     T &get()
     {
+        if (lazy_)
+            decode();
         return data_;
     }
 
     const T &get() const
     {
+        if (lazy_)
+            decode();
         return data_;
     }
 
-private:
+protected:
     T data_;
 
     value(const T &val)
@@ -62,21 +69,39 @@ std::shared_ptr<value<typename value_type_traits<T>::base_type>> make_value(T &&
     return std::make_shared<value_type>(enabler{}, std::forward<T>(val));
 }
 
-template <typename T>
-inline std::optional<T> node::value() const noexcept
+template <class Alloc, class T>
+std::shared_ptr<value<typename value_type_traits<T>::base_type>> allocate_value(const Alloc &alloc, T &&val)
+{
+    static_assert(is_value_promotable<T>,
+                  "allocate_value type must be of (or be promotable to) one of the TOML types");
+    using value_type = value<typename value_type_traits<T>::base_type>;
+    using enabler = typename value_type::make_shared_enabler;
+    return std::allocate_shared<value_type>(alloc, enabler{}, std::forward<T>(val));
+}
+
+namespace detail
+{
+/**
+ * The conversions allowed when reading a stored TOML value as T: floats
+ * accept integers, dates accept date-times, and strings can be read as
+ * std::string_view. Source must provide `stored<U>()`, returning the
+ * value only if it is stored exactly as U (strings as std::string_view).
+ */
+template <typename T, typename Source>
+inline std::optional<T> promote_value(const Source &src) noexcept
 {
     static_assert(toml::is_value_promotable<T>,
                   "value type must be one of the TOML value types (or string_view)");
 
     if constexpr (value_type_traits<T>::value == base_type::Float)
     {
-        if (auto candidate = as_value<double>())
+        if (auto candidate = src.template stored<double>())
         {
-            return {static_cast<T>(candidate->get())};
+            return {static_cast<T>(*candidate)};
         }
-        else if (auto candidate = as_value<int64_t>())
+        else if (auto candidate = src.template stored<int64_t>())
         {
-            return {static_cast<T>(candidate->get())};
+            return {static_cast<T>(*candidate)};
         }
         else
         {
@@ -85,9 +110,9 @@ inline std::optional<T> node::value() const noexcept
     }
     else if constexpr (value_type_traits<T>::value == base_type::String)
     {
-        if (auto candidate = as_value<typename value_type_traits<T>::base_type>())
+        if (auto candidate = src.template stored<std::string_view>())
         {
-            return {T{candidate->get()}};
+            return {T{*candidate}};
         }
         else
         {
@@ -97,35 +122,96 @@ inline std::optional<T> node::value() const noexcept
     else if constexpr (value_type_traits<T>::value == base_type::LocalDateTime ||
                        value_type_traits<T>::value == base_type::LocalDate)
     {
-        if (auto candidate = as_value<offset_date_time>())
+        if (auto candidate = src.template stored<offset_date_time>())
         {
-            return {static_cast<T>(candidate->get())};
+            return {static_cast<T>(*candidate)};
         }
-        else if (auto candidate = as_value<local_date_time>())
+        else if (auto candidate = src.template stored<local_date_time>())
         {
-            return {static_cast<T>(candidate->get())};
+            return {static_cast<T>(*candidate)};
         }
-        else if (auto candidate = as_value<local_date>();
-                 candidate && value_type_traits<T>::value == base_type::LocalDate)
+        else if constexpr (value_type_traits<T>::value == base_type::LocalDate)
         {
-            return {candidate->get()};
+            if (auto candidate = src.template stored<local_date>())
+            {
+                return {*candidate};
+            }
+        }
+        return std::nullopt;
+    }
+    else
+    {
+        if (auto candidate = src.template stored<typename value_type_traits<T>::base_type>())
+        {
+            return {static_cast<T>(*candidate)};
         }
         else
         {
             return std::nullopt;
         }
     }
-    else
+}
+
+/**
+ * promote_value() source reading a node of the shared_ptr tree.
+ */
+struct node_source
+{
+    const node &n;
+
+    template <typename U>
+    std::optional<U> stored() const noexcept
     {
-        if (auto candidate = as_value<typename value_type_traits<T>::base_type>())
+        if constexpr (std::is_same_v<U, std::string_view>)
+        {
+            if (n.type() == base_type::String)
+            {
+                return {std::string_view{static_cast<const toml::value<std::string> &>(n).get()}};
+            }
+        }
+        else if (n.type() == base_type_traits<U>::value)
         {
-            return {static_cast<T>(candidate->get())};
+            return {static_cast<const toml::value<U> &>(n).get()};
+        }
+        return std::nullopt;
+    }
+};
+
+/**
+ * promote_value() source reading a single stored value, such as an element
+ * of a packed array.
+ */
+template <typename T>
+struct scalar_source
+{
+    const T &v;
+
+    template <typename U>
+    std::optional<U> stored() const noexcept
+    {
+        if constexpr (std::is_same_v<U, std::string_view> && std::is_same_v<T, std::string>)
+        {
+            return {std::string_view{v}};
+        }
+        else if constexpr (std::is_same_v<U, T>)
+        {
+            return {v};
         }
         else
         {
             return std::nullopt;
         }
     }
+};
+
+template <typename T>
+scalar_source(const T &) -> scalar_source<T>;
+} // namespace detail
+
+template <typename T>
+inline std::optional<T> node::value() const noexcept
+{
+    return detail::promote_value<T>(detail::node_source{*this});
 }
 
 TOML_NAMESPACE_END
@@ -1,28 +1,60 @@
 #pragma once
 
 #include <algorithm>
-#include <limits>
+#include <charconv>
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#include <vector>
 
 #include "value.h"
 #include "array.h"
 #include "table.h"
 #include "node_view.h"
+#include "scan.h"
 
 namespace toml
 {
 TOML_NAMESPACE_BEGIN
 
+namespace detail
+{
+class struct_encoder;
+} // namespace detail
+
+/**
+ * Serializes a TOML tree.
+ *
+ * Output is appended to a contiguous buffer: either a caller-supplied
+ * string, or an internal one that is handed to the stream in large blocks
+ * and whenever the outermost visit completes. Table entries are walked
+ * in place, without copying their keys.
+ */
 class toml_writer
 {
+    friend class detail::struct_encoder;
+
 public:
     /**
      * Construct a toml_writer that will write to the given stream
      */
     toml_writer(std::ostream &s, size_t indent_space = 4)
-        : stream_(s),
+        : stream_(&s),
+          out_(&buffer_),
           indent_(indent_space, ' '),
           has_naked_endline_(false) {}
 
+    /**
+     * Construct a toml_writer that appends to the given string
+     */
+    toml_writer(std::string &out, size_t indent_space = 4)
+        : out_(&out),
+          indent_(indent_space, ' '),
+          has_naked_endline_(false) {}
+
+    toml_writer(const toml_writer &) = delete;
+    toml_writer &operator=(const toml_writer &) = delete;
+
 public:
     /**
      * Output a node value of the TOML tree.
@@ -30,7 +62,9 @@ public:
     template <class T>
     void visit(const value<T> &v, bool = false)
     {
+        scope s{*this};
         write(v);
+        s.leave();
     }
 
     /**
@@ -38,63 +72,56 @@ public:
      */
     void visit(const table &t, bool in_array = false)
     {
+        scope s{*this};
         write_table_header(in_array);
-        std::vector<std::string> values;
-        std::vector<std::string> tables;
 
+        // plain values first, then arrays of tables, then sub-tables, each
+        // group by key; ordered tables already iterate by key
+        const auto base = order_.size();
         for (const auto &i : t)
         {
-            if (i.second->is<table>())
-            {
-                tables.push_back(i.first);
-            }
-            else
-            {
-                values.push_back(i.first);
-            }
+            order_.push_back(&i);
         }
-
-        std::sort(values.begin(), values.end(),
-                  [&](const auto &lhs, const auto &rhs)
-                  {
-                      return t.at(lhs)->is_table_array() < t.at(rhs)->is_table_array()
-                                 ? true
-                                 : lhs < rhs;
-                  });
-
-        for (size_t i = 0; i < values.size(); ++i)
+        if (t.storage() == table_storage::hashed)
         {
-            path_.push_back(values[i]);
+            std::sort(order_.begin() + base, order_.end(),
+                      [](const auto *lhs, const auto *rhs)
+                      {
+                          return lhs->first.view() < rhs->first.view();
+                      });
+        }
 
-            if (i > 0)
+        const auto count = order_.size() - base;
+        size_t written = 0;
+        for (int group = 0; group < 3; ++group)
+        {
+            for (size_t i = 0; i < count; ++i)
             {
-                endline();
-
-                if (t.at(values[i])->is_table_array())
-                    stream_ << "\n";
-            }
+                const auto &[key, child] = *order_[base + i];
+                if (group_of(*child) != group)
+                    continue;
 
-            write_table_item_header(*(t.at(values[i])));
+                path_.push_back(key.view());
 
-            t.at(values[i])->accept(*this, false);
-
-            path_.pop_back();
-        }
+                if (written++ > 0)
+                {
+                    endline();
 
-        for (unsigned int i = 0; i < tables.size(); ++i)
-        {
-            path_.push_back(tables[i]);
+                    if (group == 1)
+                        out_->push_back('\n');
+                }
 
-            if (values.size() > 0 || i > 0)
-                endline();
+                write_table_item_header(*child);
+                child->accept(*this, false);
 
-            write_table_item_header(*(t.at(tables[i])));
-            t.at(tables[i])->accept(*this, false);
-            path_.pop_back();
+                path_.pop_back();
+            }
         }
+        order_.resize(base);
 
         endline();
-        stream_ << "\n";
+        out_->push_back('\n');
+        s.leave();
     }
 
     /**
@@ -102,6 +129,7 @@ public:
      */
     void visit(const array &a, bool = false)
     {
+        scope s{*this};
         if (a.is_table_array())
         {
             for (size_t i = 0; i < a.size(); ++i)
@@ -109,14 +137,15 @@ public:
                 a.at(i)->get<table>()->accept(*this, true);
             }
         }
-        else
+        else if (!a.visit_packed([&](const auto &elements)
+                                 { write_elements(elements); }))
         {
-            write("[");
+            write_raw('[');
 
             for (unsigned int i = 0; i < a.get().size(); ++i)
             {
                 if (i > 0)
-                    write(", ");
+                    write_raw(", ");
 
                 if (auto n = a.at(i); n->is<array>())
                 {
@@ -128,59 +157,90 @@ public:
                 }
             }
 
-            write("]");
+            write_raw(']');
+        }
+        s.leave();
+    }
+
+    /**
+     * Output a struct bound with TOML_BIND, or a map with std::string keys,
+     * as a document without building a tree first.
+     */
+    template <class T>
+    inline void encode(const T &obj); // implemented in bind.h
+
+    /**
+     * Hand everything written so far to the stream.
+     */
+    void flush()
+    {
+        if (stream_ && !buffer_.empty())
+        {
+            stream_->write(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+            buffer_.clear();
         }
     }
 
     /**
      * Escape a string for output.
      */
-    static std::string escape_string(const std::string &str)
+    static std::string escape_string(std::string_view str)
     {
         std::string res;
-        for (auto it = str.begin(); it != str.end(); ++it)
+        escape_string(str, res);
+        return res;
+    }
+
+    /**
+     * Escape a string, appending it to out. Runs that need no escaping are
+     * copied whole.
+     */
+    static void escape_string(std::string_view str, std::string &out)
+    {
+        static constexpr char hex[] = "0123456789ABCDEF";
+
+        out.reserve(out.size() + str.size());
+        const char *it = str.data();
+        const char *end = it + str.size();
+        while (true)
         {
-            if (*it == '\b')
-            {
-                res += "\\b";
-            }
-            else if (*it == '\t')
-            {
-                res += "\\t";
-            }
-            else if (*it == '\n')
-            {
-                res += "\\n";
-            }
-            else if (*it == '\f')
-            {
-                res += "\\f";
-            }
-            else if (*it == '\r')
-            {
-                res += "\\r";
-            }
-            else if (*it == '"')
+            auto special = detail::find_escape(it, end);
+            out.append(it, special);
+            if (special == end)
+                break;
+
+            switch (*special)
             {
-                res += "\\\"";
-            }
-            else if (*it == '\\')
+            case '\b':
+                out += "\\b";
+                break;
+            case '\t':
+                out += "\\t";
+                break;
+            case '\n':
+                out += "\\n";
+                break;
+            case '\f':
+                out += "\\f";
+                break;
+            case '\r':
+                out += "\\r";
+                break;
+            case '"':
+                out += "\\\"";
+                break;
+            case '\\':
+                out += "\\\\";
+                break;
+            default:
             {
-                res += "\\\\";
+                auto c = static_cast<uint8_t>(*special);
+                const char code[] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf]};
+                out.append(code, sizeof(code));
             }
-            else if (static_cast<uint32_t>(*it) <= UINT32_C(0x001f))
-            {
-                res += "\\u";
-                std::stringstream ss;
-                ss << std::hex << static_cast<uint32_t>(*it);
-                res += ss.str();
-            }
-            else
-            {
-                res += *it;
             }
+            it = special + 1;
         }
-        return res;
     }
 
 protected:
@@ -189,9 +249,7 @@ protected:
      */
     void write(const value<std::string> &v)
     {
-        write("\"");
-        write(escape_string(v.get()));
-        write("\"");
+        write_quoted(v.get());
     }
 
     /**
@@ -199,38 +257,19 @@ protected:
      */
     void write(const value<double> &v)
     {
-        std::stringstream ss;
-        ss << std::showpoint
-           << std::setprecision(std::numeric_limits<double>::max_digits10)
-           << v.get();
-
-        auto double_str = ss.str();
-
-        if (auto pos = double_str.find("e0"); pos != std::string::npos)
-        {
-            double_str.erase(pos + 1, 1);
-        }
-        if (auto pos = double_str.find("e-0"); pos != std::string::npos)
-        {
-            double_str.erase(pos + 2, 1);
-        }
-
-        stream_ << double_str;
-        has_naked_endline_ = false;
+        write_raw(v.get());
     }
 
     /**
      * Write out an integer, local_date, local_time, local_date_time, or
      * offset_date_time.
      */
-    //        is_one_of<T, int64_t, local_date, local_time, local_date_time,
-    //     offset_date_time>::value>::type
     template <class T>
     typename std::enable_if_t<is_one_of_v<T, int64_t, local_date, local_time,
                                           local_date_time, offset_date_time>>
     write(const value<T> &v)
     {
-        write(v.get());
+        write_raw(v.get());
     }
 
     /**
@@ -238,7 +277,7 @@ protected:
      */
     void write(const value<bool> &v)
     {
-        write((v.get() ? "true" : "false"));
+        write_raw(v.get() ? "true" : "false");
     }
 
     /**
@@ -250,40 +289,19 @@ protected:
         {
             indent();
 
-            write("[");
-
-            if (in_array)
-            {
-                write("[");
-            }
+            write_raw(in_array ? "[[" : "[");
 
             for (unsigned int i = 0; i < path_.size(); ++i)
             {
                 if (i > 0)
                 {
-                    write(".");
+                    write_raw('.');
                 }
 
-                if (path_[i].find_first_not_of("ABCDEFGHIJKLMNOPQRSTUVWXYZabcde"
-                                               "fghijklmnopqrstuvwxyz0123456789"
-                                               "_-") == std::string::npos)
-                {
-                    write(path_[i]);
-                }
-                else
-                {
-                    write("\"");
-                    write(escape_string(path_[i]));
-                    write("\"");
-                }
-            }
-
-            if (in_array)
-            {
-                write("]");
+                write_key(path_[i]);
             }
 
-            write("]");
+            write_raw(in_array ? "]]" : "]");
             endline();
         }
     }
@@ -296,25 +314,70 @@ protected:
         if (!b.is<table>() && !b.is_table_array())
         {
             indent();
+            write_key(path_.back());
+            write_raw(" = ");
+        }
+    }
 
-            if (path_.back().find_first_not_of("ABCDEFGHIJKLMNOPQRSTUVWXYZabcde"
-                                               "fghijklmnopqrstuvwxyz0123456789"
-                                               "_-") == std::string::npos)
-            {
-                write(path_.back());
-            }
-            else
-            {
-                write("\"");
-                write(escape_string(path_.back()));
-                write("\"");
-            }
+private:
+    /**
+     * Bumps the nesting depth for the duration of a visit. A visit that
+     * completes calls leave(): the outermost one flushes, nested ones once
+     * the buffer has filled a block. The rest of a visit that throws is
+     * dropped, not written.
+     */
+    struct scope
+    {
+        toml_writer &writer;
+
+        explicit scope(toml_writer &w) noexcept
+            : writer(w)
+        {
+            ++writer.depth_;
+        }
+
+        ~scope() noexcept
+        {
+            if (--writer.depth_ == 0 && writer.stream_)
+                writer.buffer_.clear();
+        }
 
-            write(" = ");
+        void leave()
+        {
+            if (writer.depth_ == 1 || writer.buffer_.size() >= flush_size)
+                writer.flush();
         }
+    };
+
+    static constexpr size_t flush_size = 1 << 16;
+
+    static int group_of(const node &b) noexcept
+    {
+        return b.is<table>() ? 2 : b.is_table_array() ? 1 : 0;
+    }
+
+    /**
+     * Write out the elements of a packed array.
+     */
+    template <class Elements>
+    void write_elements(const Elements &elements)
+    {
+        write_raw('[');
+        for (size_t i = 0; i < elements.size(); ++i)
+        {
+            if (i > 0)
+                write_raw(", ");
+
+            if constexpr (std::is_same_v<Elements, std::vector<bool>>)
+                write_raw(elements[i] ? "true" : "false");
+            else if constexpr (std::is_same_v<Elements, std::vector<std::string>>)
+                write_quoted(elements[i]);
+            else
+                write_raw(elements[i]);
+        }
+        write_raw(']');
     }
 
-private:
     /**
      * Indent the proper number of tabs given the size of
      * the path.
@@ -322,19 +385,144 @@ private:
     void indent()
     {
         for (std::size_t i = 1; i < path_.size(); ++i)
-            write(indent_);
+            write_raw(indent_);
+    }
+
+    void write_key(std::string_view key)
+    {
+        if (!key.empty() && std::all_of(key.begin(), key.end(), [](char c)
+                                        { return detail::is_class(c, detail::cc_bare_key); }))
+        {
+            write_raw(key);
+        }
+        else
+        {
+            write_quoted(key);
+        }
+    }
+
+    void write_raw(std::string_view s)
+    {
+        out_->append(s);
+        has_naked_endline_ = false;
+    }
+
+    void write_raw(char c)
+    {
+        out_->push_back(c);
+        has_naked_endline_ = false;
+    }
+
+    void write_quoted(std::string_view s)
+    {
+        write_raw('"');
+        escape_string(s, *out_);
+        write_raw('"');
     }
 
     /**
-     * Write a value out to the stream.
+     * Write a double in its shortest round-trip form. A '.0' is added where
+     * that form would read back as an integer; inf and nan are spelled as
+     * TOML does.
      */
-    template <class T>
-    void write(const T &v)
+    void write_raw(double v)
+    {
+        char buf[32];
+        auto end = std::to_chars(buf, buf + sizeof(buf), v).ptr;
+        auto exp = std::find(buf, end, 'e');
+
+        if (exp != end)
+        {
+            // drop the leading zeros of the exponent: 1e-07 -> 1e-7
+            auto digits = exp + 1 + (exp[1] == '+' || exp[1] == '-');
+            auto first = std::find_if(digits, end - 1, [](char c)
+                                      { return c != '0'; });
+            end = std::copy(first, end, digits);
+        }
+        else if (std::isfinite(v) && std::find(buf, end, '.') == end)
+        {
+            *end++ = '.';
+            *end++ = '0';
+        }
+
+        write_raw(std::string_view{buf, static_cast<size_t>(end - buf)});
+    }
+
+    void write_raw(int64_t v)
     {
-        stream_ << v;
+        char buf[24];
+        auto res = std::to_chars(buf, buf + sizeof(buf), v);
+        write_raw(std::string_view{buf, static_cast<size_t>(res.ptr - buf)});
+    }
+
+    /**
+     * Write an unsigned number left-padded with zeros to width digits.
+     */
+    void write_padded(uint32_t v, int width)
+    {
+        char buf[16];
+        auto res = std::to_chars(buf, buf + sizeof(buf), v);
+        for (auto n = res.ptr - buf; n < width; ++n)
+        {
+            out_->push_back('0');
+        }
+        out_->append(buf, res.ptr);
         has_naked_endline_ = false;
     }
 
+    void write_raw(const local_date &dt)
+    {
+        write_padded(dt.year, 4);
+        write_raw('-');
+        write_padded(dt.month, 2);
+        write_raw('-');
+        write_padded(dt.day, 2);
+    }
+
+    void write_raw(const local_time &ltime)
+    {
+        write_padded(ltime.hour, 2);
+        write_raw(':');
+        write_padded(ltime.minute, 2);
+        write_raw(':');
+        write_padded(ltime.second, 2);
+
+        if (ltime.nanosecond > 0)
+        {
+            write_raw('.');
+            write_padded(ltime.nanosecond, 9);
+        }
+    }
+
+    void write_raw(const time_offset &offset)
+    {
+        if (offset.minute_offset != 0)
+        {
+            write_raw(offset.minute_offset > 0 ? '+' : '-');
+            auto [hour, minute] = std::div(std::abs(offset.minute_offset), 60);
+            write_padded(static_cast<uint32_t>(hour), 2);
+            write_raw(':');
+            write_padded(static_cast<uint32_t>(minute), 2);
+        }
+        else
+        {
+            write_raw('Z');
+        }
+    }
+
+    void write_raw(const local_date_time &dt)
+    {
+        write_raw(static_cast<const local_date &>(dt));
+        write_raw('T');
+        write_raw(static_cast<const local_time &>(dt));
+    }
+
+    void write_raw(const offset_date_time &dt)
+    {
+        write_raw(static_cast<const local_date_time &>(dt));
+        write_raw(static_cast<const time_offset &>(dt));
+    }
+
     /**
      * Write an endline out to the stream
      */
@@ -342,15 +530,19 @@ private:
     {
         if (!has_naked_endline_)
         {
-            stream_ << "\n";
+            out_->push_back('\n');
             has_naked_endline_ = true;
         }
     }
 
 private:
-    std::ostream &stream_;
+    std::ostream *stream_{nullptr};
+    std::string buffer_;
+    std::string *out_;
     const std::string indent_;
-    std::vector<std::string> path_;
+    std::vector<std::string_view> path_;
+    std::vector<const table::entry *> order_;
+    size_t depth_{0};
     bool has_naked_endline_;
 };
 
@@ -1,5 +1,10 @@
+#include <clocale>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
 #include "gtest/gtest.h"
 #include "toml/toml.h"
 
@@ -74,4 +79,1170 @@ TEST(toml_test, parse_array)
                   }),
               (std::vector{"ti"sv, "li"sv, "pu"sv}));
 }
-} // namespace
\ No newline at end of file
+
+TEST(toml_test, parse_buffer)
+{
+    static constexpr auto source = "title = \"crlf\"\r\n"
+                                   "text = \"\"\"\r\nfirst\r\nsecond\"\"\"\r\n"
+                                   "[table]\r\n"
+                                   "values = [\r\n  1, # one\r\n  2,\r\n]";
+
+    auto view = toml::parse(source).ok();
+
+    EXPECT_EQ(view["title"].get<std::string_view>(), "crlf"sv);
+    EXPECT_EQ(view["text"].get<std::string_view>(), "first\nsecond"sv);
+    EXPECT_EQ(view["table.values"].collect<int>(), (std::vector{1, 2}));
+
+    std::istringstream stream{source};
+    auto root = toml::parser{stream}.parse();
+    EXPECT_EQ(root->view()["text"].get<std::string_view>(), "first\nsecond"sv);
+
+    auto err = toml::parse("a = 1\nb = [1,\n2\nc = 3");
+    EXPECT_TRUE(err.is_err());
+    EXPECT_EQ(err.err().source().line, 4u);
+}
+
+TEST(toml_test, parse_mapped_file)
+{
+    auto current_dir = std::filesystem::path(__FILE__).parent_path();
+
+    toml::mapped_file file{current_dir / "../examples/example.toml"};
+    EXPECT_TRUE(file.is_open());
+    EXPECT_TRUE(file.is_mapped());
+    EXPECT_EQ(toml::parse(file.view()).ok()["database.connection_max"].as(0), 5000);
+
+    toml::mapped_file proc{"/proc/self/status"};
+    if (proc.is_open())
+    {
+        EXPECT_FALSE(proc.is_mapped());
+        EXPECT_GT(proc.size(), 0u);
+    }
+
+    EXPECT_TRUE(parse_file(current_dir / "does_not_exist.toml").is_err());
+}
+
+TEST(toml_test, parse_numbers)
+{
+    static constexpr auto source = R"(
+        ints = [ +99, -17, 5_349_221, 0xdead_beef, 0o755, 0b1101_0110 ]
+        limits = [ 9223372036854775807, -9223372036854775808 ]
+        floats = [ +1.0, -0.01, 6.626e-34, 224_617.445_991_228, -2E-2 ]
+    )";
+
+    // the decimal point of the process locale must not leak into parsing
+    const char *previous = std::setlocale(LC_NUMERIC, nullptr);
+    std::string saved = previous ? previous : "C";
+    std::setlocale(LC_NUMERIC, "de_DE.UTF-8");
+
+    auto view = toml::parse(source).ok();
+    std::setlocale(LC_NUMERIC, saved.c_str());
+
+    EXPECT_EQ(view["ints"].collect<int64_t>(),
+              (std::vector<int64_t>{99, -17, 5349221, 0xdeadbeef, 0755, 0b11010110}));
+    EXPECT_EQ(view["limits"].collect<int64_t>(),
+              (std::vector{std::numeric_limits<int64_t>::max(), std::numeric_limits<int64_t>::min()}));
+    EXPECT_EQ(view["floats"].collect<double>(),
+              (std::vector{1.0, -0.01, 6.626e-34, 224617.445991228, -2E-2}));
+
+    EXPECT_TRUE(toml::parse("a = 9223372036854775808").is_err());
+    EXPECT_TRUE(toml::parse("a = 0b102").is_err());
+    EXPECT_TRUE(toml::parse("a = 1e400").is_err());
+}
+
+TEST(toml_test, parse_long_runs)
+{
+    std::string key(70, 'k');
+    std::string text(100, 'x');
+    std::string source = std::string(40, ' ') + key + " = \"" + text + "\\t" + text + "\"\n" +
+                         "sql = '''\n" + text + "\\n" + text + "'''\n";
+
+    auto view = toml::parse(source).ok();
+    EXPECT_EQ(view[key].get<std::string>(), text + "\t" + text);
+    EXPECT_EQ(view["sql"].get<std::string>(), text + "\\n" + text);
+
+    EXPECT_TRUE(toml::parse(key + "$ = 1").is_err());
+    EXPECT_TRUE(toml::parse(key + " " + key + " = 1").is_err());
+}
+
+TEST(toml_test, parse_arena)
+{
+    auto current_dir = std::filesystem::path(__FILE__).parent_path();
+    toml::parse_options options;
+    options.use_arena = true;
+
+    toml::node_view servers;
+    {
+        auto view = parse_file(current_dir / "../examples/example.toml", options).ok();
+        EXPECT_EQ(view["database.ports"].collect<int>(), (std::vector{8001, 8001, 8002}));
+        servers = view["servers"];
+    }
+
+    // nodes keep their arena alive after the root is gone
+    EXPECT_EQ(servers["alpha.ip"].get<std::string_view>(), "10.0.0.1"sv);
+
+    auto tbl = servers.as<toml::table>();
+    tbl->emplace("gamma", std::string{"10.0.0.3"});
+    EXPECT_EQ(servers["gamma"].get<std::string_view>(), "10.0.0.3"sv);
+}
+
+TEST(toml_test, parse_compact)
+{
+    auto current_dir = std::filesystem::path(__FILE__).parent_path();
+    toml::parse_options options;
+    options.compact = true;
+
+    auto tree = parse_file(current_dir / "../examples/example.toml").ok();
+    toml::node_view clients;
+    {
+        auto view = parse_file(current_dir / "../examples/example.toml", options).ok();
+        EXPECT_TRUE(view.is_compact());
+        EXPECT_TRUE(view.is_table());
+
+        EXPECT_EQ(view["title"].get<std::string_view>(), "TOML Example"sv);
+        EXPECT_EQ(view["owner.dob"].get<offset_date_time>()->minute_offset, -480);
+        EXPECT_EQ(view["owner"]["dob"].as<local_date>({}).year, 1979);
+        EXPECT_EQ(view["database.ports"].collect<int>(), (std::vector{8001, 8001, 8002}));
+        EXPECT_EQ(view["database.connection_max"].as<double>(), 5000.0);
+        EXPECT_TRUE(view["database.enabled"].as<bool>());
+        EXPECT_FALSE(view["database.missing"]);
+        EXPECT_FALSE(view["title"][0]);
+        EXPECT_THROW(view["title"].as<toml::table>(), std::runtime_error);
+        EXPECT_THROW(view["database.ports"].as<toml::table>(), std::runtime_error);
+        EXPECT_THROW(view["owner"].as<toml::array>(), std::runtime_error);
+        EXPECT_FALSE(view["database.ports"].get<toml::table>());
+        EXPECT_TRUE(view.contains("servers.alpha.ip"));
+        EXPECT_EQ(view["servers"].map<toml::table>([](const auto &tbl)
+                                                   { return tbl.size(); }),
+                  std::optional<size_t>{2});
+        clients = view["clients"];
+        EXPECT_EQ(view.type(), tree.type());
+
+        std::ostringstream expected, actual;
+        expected << tree;
+        actual << view;
+        EXPECT_EQ(actual.str(), expected.str());
+    }
+
+    // views keep their document alive
+    EXPECT_EQ(clients[0]["data"][0].collect<std::string_view>(),
+              (std::vector{"gamma"sv, "delta"sv}));
+    EXPECT_EQ(clients[0]["data"][1].collect<toml::node_view>().size(), 2u);
+
+    auto doc = toml::make_document(*tree.as<toml::table>());
+    auto copy = doc->to_table();
+    copy->emplace("extra", 1);
+    EXPECT_TRUE(copy->contains("extra"));
+    EXPECT_FALSE(doc->view().contains("extra"));
+}
+
+TEST(toml_test, parse_hashed_tables)
+{
+    std::string source = "[flags]\n";
+    for (int i = 999; i >= 0; --i)
+    {
+        source += "f" + std::to_string(i) + " = " + std::to_string(i) + "\n";
+    }
+    source += "[small]\nb = 1\na = { y = 2, x = 3 }\n";
+
+    toml::parse_options options;
+    options.tables = toml::table_storage::hashed;
+    auto view = toml::parse(source, options).ok();
+
+    EXPECT_EQ(view["flags"].as<toml::table>()->size(), 1000u);
+    EXPECT_EQ(view["flags.f0"].as<int>(), 0);
+    EXPECT_EQ(view["flags.f777"].as<int>(), 777);
+    EXPECT_FALSE(view.contains("flags.f1000"));
+    EXPECT_EQ(view["small.a.x"].as<int>(), 3);
+
+    // entries keep their document order
+    auto small = view["small"].as<toml::table>();
+    EXPECT_EQ(small->begin()->first, "b");
+    EXPECT_EQ(view["small.a"].as<toml::table>()->begin()->first, "y");
+
+    auto flags = view["flags"].as<toml::table>();
+    EXPECT_EQ(flags->begin()->first, "f999");
+    EXPECT_TRUE(flags->erase("f500"));
+    EXPECT_FALSE(flags->contains("f500"));
+    EXPECT_EQ(flags->at("f499")->as<int>(), 499);
+    flags->insert_or_assign("f499", toml::make_value(-1));
+    EXPECT_EQ(flags->at("f499")->as<int>(), -1);
+    EXPECT_EQ(flags->size(), 999u);
+
+    // erasing shifts entries in place and keeps every other key reachable
+    const auto *first = &*flags->begin();
+    for (int i = 0; i < 1000; i += 3)
+    {
+        flags->erase("f" + std::to_string(i));
+    }
+    EXPECT_EQ(&*flags->begin(), first);
+    EXPECT_EQ(flags->size(), 665u);
+    for (int i = 0; i < 1000; ++i)
+    {
+        auto key = "f" + std::to_string(i);
+        EXPECT_EQ(flags->contains(key), i % 3 != 0 && i != 500) << key;
+    }
+    EXPECT_EQ(flags->begin()->first, "f998");
+    flags->emplace("f0", 0);
+    EXPECT_EQ(flags->at("f0")->as<int>(), 0);
+
+    EXPECT_TRUE(toml::parse("a = 1\nb = 2\na = 3", options).is_err());
+
+    auto compact = toml::make_document(*view.as<toml::table>())->view();
+    EXPECT_EQ(compact["flags.f998"].as<int>(), 998);
+    EXPECT_EQ(compact["flags.f499"].as<int>(), -1);
+}
+
+TEST(toml_test, parse_interned_keys)
+{
+    static constexpr auto source = R"(
+        [[hosts]]
+        name = "a"
+        port = 1
+
+        [[hosts]]
+        name = "b"
+        port = 2
+    )";
+
+    auto first_key = [](const toml::node_view &view)
+    { return view.as<toml::table>()->begin()->first; };
+
+    auto view = toml::parse(source).ok();
+    auto a = first_key(view["hosts"][0]);
+    auto b = first_key(view["hosts"][1]);
+    EXPECT_EQ(a, "name");
+    EXPECT_EQ(a, b);
+    EXPECT_EQ(a.data(), b.data());
+    EXPECT_TRUE(view["hosts"][1].as<toml::table>()->contains(a));
+
+    // separate documents only share keys through the global pool
+    EXPECT_NE(first_key(toml::parse(source).ok()["hosts"][0]).data(), a.data());
+
+    toml::parse_options options;
+    options.shared_keys = true;
+    auto x = first_key(toml::parse(source, options).ok()["hosts"][0]);
+    auto y = first_key(toml::parse(source, options).ok()["hosts"][1]);
+    EXPECT_EQ(x.data(), y.data());
+    EXPECT_EQ(x, a);
+    EXPECT_EQ(x.data(), toml::key_pool::global().intern("name").data());
+
+    std::string text = x;
+    EXPECT_EQ(text, "name");
+    EXPECT_NE(toml::key{"port"}, x);
+}
+
+TEST(toml_test, parse_paths)
+{
+    static constexpr auto source = R"(
+        title = "paths"
+        "dotted.key" = 1
+        [database]
+        ports = [ 8001, 8002, [ 1, 2 ] ]
+        [[servers]]
+        name = "alpha"
+        [[servers]]
+        name = "beta"
+    )";
+
+    toml::parse_options compact;
+    compact.compact = true;
+    for (auto view : {toml::parse(source).ok(), toml::parse(source, compact).ok()})
+    {
+        EXPECT_EQ(view[toml::path{"title"}].as<std::string_view>(), "paths"sv);
+        EXPECT_EQ(view[toml::path{"database.ports[1]"}].as<int>(), 8002);
+        EXPECT_EQ(view[toml::path{"database.ports[2][0]"}].as<int>(), 1);
+        EXPECT_EQ(view[toml::path{"servers[1].name"}].as<std::string_view>(), "beta"sv);
+        EXPECT_EQ(view[toml::path{"\"dotted.key\""}].as<int>(), 1);
+        EXPECT_EQ(view[toml::path{"'dotted.key'"}].as<int>(), 1);
+        EXPECT_EQ(view["database.ports"][toml::path{"[0]"}].as<int>(), 8001);
+        EXPECT_TRUE(view[toml::path{}].is_table());
+
+        EXPECT_TRUE(view.contains(toml::path{"servers[0].name"}));
+        EXPECT_FALSE(view.contains(toml::path{"servers[2].name"}));
+        EXPECT_FALSE(view.contains(toml::path{"title[0]"}));
+        EXPECT_FALSE(view.contains(toml::path{"dotted.key"}));
+        EXPECT_FALSE(view[toml::path{"database.ports.x"}]);
+    }
+
+    for (auto bad : {"a..b", "a.", ".a", "a[", "a[x]", "a[0]b", "\"open", "a.[0]", "a b"})
+    {
+        EXPECT_THROW(toml::path{bad}, std::invalid_argument) << bad;
+    }
+}
+
+TEST(toml_test, parse_node_ref)
+{
+    auto current_dir = std::filesystem::path(__FILE__).parent_path();
+    toml::parse_options compact;
+    compact.compact = true;
+
+    for (const auto &options : {toml::parse_options{}, compact})
+    {
+        auto view = parse_file(current_dir / "../examples/example.toml", options).ok();
+        toml::node_ref root = view.ref();
+
+        EXPECT_EQ(root.is_compact(), options.compact);
+        EXPECT_EQ(root["title"].get<std::string_view>(), "TOML Example"sv);
+        EXPECT_EQ(root["owner"]["dob"].as<local_date>({}).year, 1979);
+        EXPECT_EQ(root["database.ports"].collect<int>(), (std::vector{8001, 8001, 8002}));
+        EXPECT_EQ(root["database"]["ports"][2].as<int>(), 8002);
+        EXPECT_EQ(root[toml::path{"clients[0].data[0][1]"}].as<std::string_view>(), "delta"sv);
+        EXPECT_TRUE(root.contains("servers.alpha.ip"));
+        EXPECT_FALSE(root["servers"][0]);
+        EXPECT_EQ(root["clients"][0]["data"].collect<toml::node_ref>().size(), 2u);
+        EXPECT_EQ(root["servers"].map<toml::node_ref>([](const toml::node_ref &r)
+                                                      { return r["beta.ip"].as<std::string_view>(); }),
+                  std::optional{"10.0.0.2"sv});
+
+        // an owning view can be taken back from a ref
+        auto servers = root["servers"].view();
+        view = {};
+        EXPECT_EQ(servers["alpha.dc"].get<std::string_view>(), "eqdc10"sv);
+    }
+}
+
+TEST(toml_test, parse_snapshot)
+{
+    auto make = [](int version)
+    {
+        auto text = "version = " + std::to_string(version) + "\n[check]\nversion = " +
+                    std::to_string(version) + "\n";
+        return toml::snapshot{toml::parse(text).ok()};
+    };
+
+    toml::snapshot_slot slot{make(0)};
+    EXPECT_EQ(slot.read().root()["version"].as<int>(), 0);
+    EXPECT_THROW(toml::snapshot{toml::parse("a = [1]").ok()["a"]}, std::invalid_argument);
+
+    std::atomic<bool> done{false};
+    std::atomic<int> mismatches{0};
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 4; ++i)
+    {
+        readers.emplace_back([&]()
+                             {
+            int last = 0;
+            while (!done.load())
+            {
+                auto guard = slot.read();
+                auto version = guard.root()["version"].as<int>();
+                if (version < last || guard.root()["check.version"].as<int>() != version)
+                    ++mismatches;
+                last = version;
+            } });
+    }
+
+    auto kept = slot.load();
+    for (int version = 1; version <= 200; ++version)
+    {
+        slot.store(make(version));
+    }
+    done = true;
+    for (auto &reader : readers)
+    {
+        reader.join();
+    }
+
+    EXPECT_EQ(mismatches.load(), 0);
+    EXPECT_EQ(slot.load().view()["version"].as<int>(), 200);
+    EXPECT_EQ(kept.root()["check.version"].as<int>(), 0);
+}
+
+TEST(toml_test, parse_files)
+{
+    auto current_dir = std::filesystem::path(__FILE__).parent_path();
+    auto example = current_dir / "../examples/example.toml";
+
+    auto dir = std::filesystem::temp_directory_path() / ("toml_parse_files_" + std::to_string(::getpid()));
+    std::filesystem::create_directories(dir / "nested");
+    for (int i = 0; i < 12; ++i)
+    {
+        std::ofstream{dir / ("file" + std::to_string(i) + ".toml")} << "index = " << i << "\n";
+    }
+    std::ofstream{dir / "nested" / "broken.toml"} << "key = \n";
+    std::ofstream{dir / "notes.txt"} << "not toml\n";
+
+    std::vector<std::filesystem::path> files{example, dir / "missing.toml", dir / "file3.toml"};
+    for (size_t threads : {1, 4})
+    {
+        auto results = toml::parse_files(files, {}, threads);
+        ASSERT_EQ(results.size(), 3u);
+        EXPECT_EQ(results[0].ok()["title"].as<std::string_view>(), "TOML Example"sv);
+        EXPECT_TRUE(results[1].is_err());
+        EXPECT_EQ(results[2].ok()["index"].as<int>(), 3);
+    }
+
+    toml::thread_pool pool{3};
+    toml::parse_options options;
+    options.compact = true;
+    auto compact = toml::parse_files(files, options, pool);
+    EXPECT_TRUE(compact[0].ok().is_compact());
+
+    auto parsed = toml::parse_directory(dir, {}, 4);
+    ASSERT_EQ(parsed.size(), 13u);
+    size_t errors = 0;
+    for (auto &file : parsed)
+    {
+        if (file.result.is_err())
+        {
+            ++errors;
+            EXPECT_EQ(file.path.filename(), "broken.toml");
+        }
+        else
+        {
+            auto name = file.path.stem().string();
+            EXPECT_EQ(file.result.ok()["index"].as<int>(), std::stoi(name.substr(4)));
+        }
+    }
+    EXPECT_EQ(errors, 1u);
+    EXPECT_THROW(toml::parse_directory(dir / "missing"), std::filesystem::filesystem_error);
+
+    std::filesystem::remove_all(dir);
+}
+
+TEST(toml_test, parse_parallel)
+{
+    std::string text = "title = \"inventory\"\n[server]\nport = 1\n";
+    for (int i = 0; i < 4000; ++i)
+    {
+        auto n = std::to_string(i);
+        text += "[[hosts]]\nname = \"host-" + n + "\"\n";
+        text += "tags = [\n  [1, 2],\n  [\"a\", \"]\"],\n]\n";
+        text += "notes = \"\"\"\n[not.a.header]\n\\\"\"\"\n[[nor.this]]\"\"\"\n";
+        text += "literal = \'\'\'\n[[hosts]]\'\'\'\n";
+        text += "[hosts.meta]\nid = " + n + "\nrack.row = " + std::to_string(i % 7) + "\n";
+        if (i % 500 == 0)
+            text += "[groups.g" + n + "]\nsize = " + n + "\n[groups]\nlast.g" + n + " = true\n";
+    }
+    ASSERT_GT(text.size(), 512u * 1024);
+
+    auto sequential = parse(text).ok();
+    for (auto tables : {toml::table_storage::ordered, toml::table_storage::hashed})
+    {
+        toml::parse_options options;
+        options.threads = 4;
+        options.tables = tables;
+        options.use_arena = tables == toml::table_storage::hashed;
+        auto parallel = parse(text, options).ok();
+        ASSERT_TRUE(bool(parallel));
+        EXPECT_EQ(parallel["hosts"].as<toml::array>()->size(), 4000u);
+        EXPECT_EQ(parallel["hosts"][3999]["meta"]["id"].as<int>(), 3999);
+        EXPECT_EQ(parallel["hosts"][42]["notes"].as<std::string_view>(),
+                  "[not.a.header]\n\"\"\"\n[[nor.this]]"sv);
+
+        std::ostringstream expected, actual;
+        expected << static_cast<const toml::table &>(sequential.get());
+        actual << static_cast<const toml::table &>(parallel.get());
+        if (tables == toml::table_storage::ordered)
+        {
+            EXPECT_EQ(actual.str(), expected.str());
+        }
+    }
+
+    // errors found while merging are reported as a sequential parse would
+    for (const auto *tail : {"[server]\nport = 2\n", "[groups]\nlast.g0 = false\n", "[hosts.meta]\nid = 1\n"})
+    {
+        toml::parse_options options;
+        options.threads = 4;
+        auto expected = parse(text + tail);
+        auto actual = parse(text + tail, options);
+        ASSERT_TRUE(expected.is_err());
+        ASSERT_TRUE(actual.is_err());
+        EXPECT_EQ(actual.err().description(), expected.err().description());
+        EXPECT_EQ(actual.err().source().line, expected.err().source().line);
+    }
+}
+
+TEST(toml_test, parse_events)
+{
+    static constexpr auto source = R"(title = "rules"
+[[rules]]
+name = "deny"
+priority = 10
+ports = [ 22, 23 ]
+[[rules]]
+name = "allow"
+priority = 20
+match = { host = "a", port = 8080 }
+[limits]
+rate.burst = 1.5
+)";
+
+    // loads [[rules]] straight into columns
+    struct rule_columns : toml::event_handler
+    {
+        using toml::event_handler::on_value;
+
+        std::vector<std::string> names;
+        std::vector<int64_t> priorities;
+        std::vector<std::string> events;
+        std::vector<toml::source_position> positions;
+        bool in_rules = false;
+        std::string key;
+        int depth = 0;
+
+        void on_table_header(toml::span<const std::string> name, bool is_array,
+                             const toml::source_position &position)
+        {
+            in_rules = is_array && name.size() == 1 && name[0] == "rules";
+            events.push_back((is_array ? "[[" : "[") + name[0] + "]");
+            positions.push_back(position);
+        }
+
+        void on_key(toml::span<const std::string> k, const toml::source_position &)
+        {
+            key = k[k.size() - 1];
+        }
+
+        void on_value(std::string &&val, const toml::source_position &)
+        {
+            if (in_rules && depth == 0 && key == "name")
+                names.push_back(std::move(val));
+        }
+
+        void on_value(int64_t val, const toml::source_position &position)
+        {
+            if (in_rules && depth == 0 && key == "priority")
+                priorities.push_back(val);
+            if (val == 8080)
+                positions.push_back(position);
+        }
+
+        void on_array_begin(const toml::source_position &)
+        {
+            ++depth;
+            events.push_back("array");
+        }
+
+        void on_array_end(const toml::source_position &)
+        {
+            --depth;
+        }
+
+        void on_inline_table_begin(const toml::source_position &)
+        {
+            ++depth;
+            events.push_back("inline");
+        }
+
+        void on_inline_table_end(const toml::source_position &)
+        {
+            --depth;
+        }
+    };
+
+    rule_columns rules;
+    EXPECT_FALSE(toml::parse_events(source, rules).has_value());
+    EXPECT_EQ(rules.names, (std::vector<std::string>{"deny", "allow"}));
+    EXPECT_EQ(rules.priorities, (std::vector<int64_t>{10, 20}));
+    EXPECT_EQ(rules.events, (std::vector<std::string>{"[[rules]", "array", "[[rules]", "inline", "[limits]"}));
+    ASSERT_EQ(rules.positions.size(), 4u);
+    EXPECT_EQ(rules.positions[1].line, 6u);
+    EXPECT_EQ(rules.positions[2].line, 9u);
+    EXPECT_EQ(rules.positions[2].column, 30u);
+
+    // syntax errors stop the events; redefinitions are the tree's business
+    toml::event_handler ignore;
+    auto err = toml::parse_events("a = 1\nb = [1,\n2\nc = 3", ignore);
+    ASSERT_TRUE(err.has_value());
+    EXPECT_EQ(err->source().line, 4u);
+    EXPECT_FALSE(toml::parse_events("a = 1\na = 2\n[t]\n[t]", ignore).has_value());
+    EXPECT_TRUE(toml::parse("a = 1\na = 2").is_err());
+
+    auto current_dir = std::filesystem::path(__FILE__).parent_path();
+    EXPECT_FALSE(toml::parse_file_events(current_dir / "../examples/example.toml", ignore).has_value());
+    EXPECT_TRUE(toml::parse_file_events(current_dir / "does_not_exist.toml", ignore).has_value());
+}
+
+TEST(toml_test, parse_selected)
+{
+    auto current_dir = std::filesystem::path(__FILE__).parent_path();
+    toml::parse_options options;
+    options.select = {toml::path{"owner.name"}, toml::path{"servers.beta"},
+                      toml::path{"clients.hosts.name"}, toml::path{"point.x"}};
+
+    for (size_t threads : {1, 4})
+    {
+        options.threads = threads;
+        auto view = parse_file(current_dir / "../examples/example.toml", options).ok();
+        ASSERT_TRUE(bool(view));
+
+        EXPECT_EQ(view["owner.name"].as<std::string_view>(), "Tom Preston-Werner"sv);
+        EXPECT_FALSE(view.contains("owner.dob"));
+        EXPECT_FALSE(view.contains("title"));
+        EXPECT_FALSE(view.contains("database"));
+        EXPECT_EQ(view["servers.beta.ip"].as<std::string_view>(), "10.0.0.2"sv);
+        EXPECT_FALSE(view.contains("servers.alpha"));
+
+        // every table of an array of tables is kept, and arrays keep all
+        // their elements
+        EXPECT_EQ(view["clients"].as<toml::array>()->size(), 2u);
+        EXPECT_FALSE(view["clients"][0].contains("data"));
+        EXPECT_EQ(view["clients"][1]["hosts"][0]["name"].as<std::string_view>(), "alpha"sv);
+        EXPECT_EQ(view["clients"][1]["hosts"][1].as<std::string_view>(), "omega"sv);
+    }
+
+    // the rest is still checked for syntax, but not for redefinitions
+    options.threads = 1;
+    auto inline_table = toml::parse("point = { x = 1, y = [2, {z = 3}] }\nother = [ {a = \"b\"} ]", options).ok();
+    EXPECT_EQ(inline_table["point"].as<toml::table>()->size(), 1u);
+    EXPECT_EQ(inline_table["point.x"].as<int>(), 1);
+    EXPECT_FALSE(inline_table.contains("other"));
+    EXPECT_TRUE(toml::parse("[other]\na = [1, 2", options).is_err());
+    EXPECT_TRUE(toml::parse("[other]\na = 1\na = 2", options).is_ok());
+    EXPECT_TRUE(toml::parse("[owner]\nname = 1\nname = 2", options).is_err());
+
+    options.select = {toml::path{"clients[0]"}};
+    EXPECT_THROW(toml::parse("a = 1", options), std::invalid_argument);
+}
+
+TEST(toml_test, parse_lazy)
+{
+    auto source = std::make_unique<std::string>(
+        "plain = \"abc\"\n"
+        "escaped = \"tab\\there \\u00e9\"   # comment\n"
+        "literal = 'C:\\path'\n"
+        "text = \"\"\"\r\nfirst\r\nsecond\"\"\"\n"
+        "[table]\nnames = [ \"x\", 'y', {z = \"w\"} ]\n");
+
+    toml::parse_options options;
+    options.lazy = true;
+    auto view = toml::parse(*source, options).ok();
+    auto names = view["table.names"];
+    std::ostringstream expected, actual;
+    expected << toml::parse(*source).ok();
+    source.reset();
+
+    // the strings are decoded once, whichever thread reads them first
+    std::vector<std::thread> readers;
+    std::atomic<int> mismatches{0};
+    for (int i = 0; i < 4; ++i)
+    {
+        readers.emplace_back([&]()
+                             {
+            if (view["escaped"].as<std::string_view>() != "tab\there \xc3\xa9"sv)
+                ++mismatches; });
+    }
+    for (auto &reader : readers)
+    {
+        reader.join();
+    }
+    EXPECT_EQ(mismatches.load(), 0);
+
+    EXPECT_EQ(view["plain"].as<std::string>(), "abc");
+    EXPECT_EQ(view["literal"].as<std::string_view>(), "C:\\path"sv);
+    EXPECT_EQ(view["text"].as<std::string_view>(), "first\nsecond"sv);
+    actual << view;
+    EXPECT_EQ(actual.str(), expected.str());
+    view = {};
+    EXPECT_EQ(names.collect<std::string_view>(), (std::vector{"x"sv, "y"sv}));
+    EXPECT_EQ(names[2]["z"].as<std::string_view>(), "w"sv);
+
+    auto copy = names.as<toml::array>()->clone();
+    EXPECT_EQ(copy->view()[1].as<std::string_view>(), "y"sv);
+
+    // malformed strings are still reported while parsing
+    EXPECT_TRUE(toml::parse("a = \"\\q\"", options).is_err());
+    EXPECT_TRUE(toml::parse("a = \"\"\"open", options).is_err());
+}
+
+TEST(toml_test, parse_writer)
+{
+    const auto source =
+        "title = \"t\"\n"
+        "\"odd key\" = [1, 2.5, \"s\", 1979-05-27T07:32:00.5-07:30]\n"
+        "[[clients]]\nname = \"a\"\n"
+        "[[clients]]\nname = \"b\"\n"
+        "[owner]\nwhen = 07:32:00\n"
+        "[database]\nports = [8001, 8002]\n"sv;
+
+    toml::parse_options options;
+    options.tables = toml::table_storage::hashed;
+    auto ordered = toml::parse(source).ok();
+    auto hashed = toml::parse(source, options).ok();
+
+    std::ostringstream expected;
+    expected << ordered;
+
+    // hashed tables are written in the same key order
+    std::string actual;
+    toml::toml_writer writer{actual};
+    hashed.accept(writer);
+    EXPECT_EQ(actual, expected.str());
+    EXPECT_NE(actual.find("\"odd key\" = [1, 2.5, \"s\", "
+                          "1979-05-27T07:32:00.500000000-07:30]"),
+              std::string::npos);
+    EXPECT_NE(actual.find("[[clients]]\n    name = \"b\""), std::string::npos);
+
+    // a stream writer has flushed when the outermost visit returns
+    std::ostringstream stream;
+    toml::toml_writer stream_writer{stream};
+    ordered.accept(stream_writer);
+    EXPECT_EQ(stream.str(), expected.str());
+    EXPECT_TRUE(toml::parse(stream.str()).is_ok());
+
+    // nothing of a visit that throws reaches the stream
+    std::ostringstream failed;
+    toml::toml_writer failed_writer{failed};
+    std::map<std::string, uint64_t> too_big{{"a", 1}, {"b", std::numeric_limits<uint64_t>::max()}};
+    EXPECT_THROW(failed_writer.encode(too_big), std::out_of_range);
+    EXPECT_TRUE(failed.str().empty());
+    ordered.accept(failed_writer);
+    EXPECT_EQ(failed.str(), expected.str());
+}
+
+TEST(toml_test, parse_float_format)
+{
+    auto view = toml::parse("a = 0.1\nb = 1e20\nc = -1.0e-7\nd = 100.0\ne = -0.0\n"
+                            "f = inf\ng = -inf\nh = nan\ni = 5e-324\n")
+                    .ok();
+    std::ostringstream out;
+    out << view;
+    EXPECT_EQ(out.str(), "a = 0.1\nb = 1e+20\nc = -1e-7\nd = 100.0\ne = -0.0\n"
+                         "f = inf\ng = -inf\nh = nan\ni = 5e-324\n\n");
+
+    // the shortest form reads back as the same double
+    auto again = toml::parse(out.str()).ok();
+    for (auto key : {"a", "b", "c", "d", "i"})
+    {
+        EXPECT_EQ(again[key].as<double>(), view[key].as<double>()) << key;
+    }
+    EXPECT_TRUE(std::signbit(again["e"].as<double>()));
+    EXPECT_TRUE(std::isnan(again["h"].as<double>()));
+}
+
+TEST(toml_test, parse_escape_string)
+{
+    EXPECT_EQ(toml::toml_writer::escape_string("a\"b\\c\b\t\n\f\r\x01\x1f\x7f\xc3\xa9"),
+              "a\\\"b\\\\c\\b\\t\\n\\f\\r\\u0001\\u001F\\u007F\xc3\xa9");
+
+    // specials at every offset of runs longer than one vector block
+    for (size_t length : {15u, 16u, 31u, 32u, 33u, 70u})
+    {
+        for (size_t pos = 0; pos < length; ++pos)
+        {
+            for (char special : {'"', '\x02', '\x7f'})
+            {
+                std::string text(length, 'x');
+                text[pos] = special;
+                text[length - 1 - pos / 2] = '\xe2';
+
+                std::string escaped = "prefix";
+                toml::toml_writer::escape_string(text, escaped);
+                auto doc = toml::parse("s = \"" + escaped.substr(6) + "\"");
+                ASSERT_TRUE(doc.is_ok()) << escaped;
+                EXPECT_EQ(doc.ok()["s"].as<std::string>(), text);
+                EXPECT_EQ(escaped.substr(0, 6 + pos), "prefix" + text.substr(0, pos));
+            }
+        }
+    }
+}
+
+TEST(toml_test, parse_packed_array)
+{
+    auto view = toml::parse("ints = [8000, 8001, 8002]\n"
+                            "floats = [0.5, 1.5]\n"
+                            "flags = [true, false, true]\n"
+                            "names = ['a', \"b\"]\n"
+                            "mixed = [1, 2.5]\n"
+                            "nested = [[1, 2], [3]]\n"
+                            "empty = []\n")
+                    .ok();
+
+    auto ints = view["ints"].as_span<int64_t>();
+    ASSERT_EQ(ints.size(), 3u);
+    EXPECT_EQ(ints[0], 8000);
+    EXPECT_EQ(ints[2], 8002);
+    EXPECT_EQ(view["floats"].as_span<double>()[1], 1.5);
+    EXPECT_EQ(view["names"].as_span<std::string>()[1], "b");
+    EXPECT_TRUE(view["ints"].as_span<double>().empty());
+    EXPECT_TRUE(view["mixed"].as_span<int64_t>().empty());
+    EXPECT_EQ(view["nested"][0].as_span<int64_t>().size(), 2u);
+
+    EXPECT_EQ(view["ints"].collect<int>(), (std::vector{8000, 8001, 8002}));
+    EXPECT_EQ(view["ints"].collect<double>(), (std::vector{8000.0, 8001.0, 8002.0}));
+    EXPECT_EQ(view["flags"].collect<bool>(), (std::vector{true, false, true}));
+    EXPECT_EQ(view["names"].collect<std::string_view>(), (std::vector{"a"sv, "b"sv}));
+    EXPECT_EQ(view["mixed"].collect<double>(), (std::vector{1.0, 2.5}));
+    EXPECT_TRUE(view["names"].collect<int>().empty());
+    EXPECT_EQ(view["floats"].map_collect<double>([](double d)
+                                                 { return d * 2; }),
+              (std::vector{1.0, 3.0}));
+
+    auto arr = view["ints"].as<toml::array>();
+    EXPECT_TRUE(arr->is_packed());
+    EXPECT_EQ(arr->packed_type(), base_type::Integer);
+    EXPECT_TRUE(arr->is_homogeneous<int64_t>());
+    EXPECT_FALSE(view["mixed"].as<toml::array>()->is_packed());
+    EXPECT_FALSE(view["empty"].as<toml::array>()->is_packed());
+
+    // element nodes are built once, whichever reader needs them first
+    std::vector<std::thread> readers;
+    std::atomic<int> mismatches{0};
+    for (int i = 0; i < 4; ++i)
+    {
+        readers.emplace_back([&]()
+                             {
+            if (view["ints"][1].as<int>() != 8001 || view["flags"][2].as<bool>() != true)
+                ++mismatches; });
+    }
+    for (auto &reader : readers)
+    {
+        reader.join();
+    }
+    EXPECT_EQ(mismatches.load(), 0);
+    EXPECT_EQ(view["ints"].as_span<int64_t>().data(), ints.data());
+
+    std::ostringstream out;
+    out << view;
+    EXPECT_NE(out.str().find("flags = [true, false, true]\n"), std::string::npos);
+    EXPECT_NE(out.str().find("names = [\"a\", \"b\"]\n"), std::string::npos);
+
+    auto copy = std::static_pointer_cast<toml::array>(arr->clone());
+    EXPECT_TRUE(copy->is_packed());
+
+    // reading through the node interface, even without const, keeps it packed
+    int64_t sum = 0;
+    for (auto &element : *arr)
+    {
+        sum += element->as(int64_t{0});
+    }
+    EXPECT_EQ(sum, 8000 + 8001 + 8002);
+    EXPECT_EQ(arr->front()->as(0), 8000);
+    EXPECT_TRUE(arr->is_packed());
+    EXPECT_EQ(view["ints"].as_span<int64_t>().data(), ints.data());
+
+    // packed elements appended after a read show up as nodes too
+    auto small = toml::parse("a = [1, 2]").ok()["a"].as<toml::array>();
+    EXPECT_EQ(std::as_const(*small).get().size(), 2u);
+    EXPECT_TRUE(small->push_packed(int64_t{3}));
+    EXPECT_EQ(small->size(), 3u);
+    EXPECT_EQ(small->get().size(), 3u);
+    EXPECT_EQ(small->back()->as(0), 3);
+    EXPECT_EQ(small->collect<int>(), (std::vector{1, 2, 3}));
+
+    // changing an array through its nodes unpacks it
+    arr->push_back(toml::make_value(8003));
+    EXPECT_FALSE(arr->is_packed());
+    EXPECT_TRUE(view["ints"].as_span<int64_t>().empty());
+    EXPECT_EQ(view["ints"].collect<int>(), (std::vector{8000, 8001, 8002, 8003}));
+    EXPECT_EQ(copy->size(), 3u);
+}
+
+TEST(toml_test, parse_array_summary)
+{
+    auto view = toml::parse("inline = [{x = 1}, {y = 2}]\n"
+                            "nested = [[1], [\"x\"], [{z = 3}]]\n"
+                            "mixed = [1, {x = 1}]\n"
+                            "empty = []\n"
+                            "[[hosts]]\nname = \"a\"\n"
+                            "[[hosts]]\nname = \"b\"\n")
+                    .ok();
+
+    auto hosts = view["hosts"].as<toml::array>();
+    EXPECT_EQ(hosts->type(), base_type::TableArray);
+    EXPECT_EQ(hosts->element_type(), base_type::Table);
+    EXPECT_FALSE(hosts->has_inline_table());
+
+    auto inline_tables = view["inline"].as<toml::array>();
+    EXPECT_TRUE(inline_tables->is_table_array());
+    EXPECT_TRUE(inline_tables->has_inline_table());
+
+    // arrays of arrays count as homogeneous whatever the inner elements are
+    EXPECT_TRUE(view["nested"].as<toml::array>()->is_homogeneous<toml::array>());
+    EXPECT_EQ(view["nested"].as<toml::array>()->element_type(), base_type::Array);
+
+    auto mixed = view["mixed"].as<toml::array>();
+    EXPECT_EQ(mixed->element_type(), base_type::None);
+    EXPECT_TRUE(mixed->has_inline_table());
+    EXPECT_FALSE(mixed->is_table_array());
+    EXPECT_EQ(view["empty"].as<toml::array>()->element_type(), base_type::None);
+
+    // appending keeps the summary current, other changes recompute it
+    hosts->push_back(toml::make_value(1));
+    EXPECT_EQ(hosts->element_type(), base_type::None);
+    EXPECT_FALSE(hosts->is_table_array());
+    hosts->pop_back();
+    EXPECT_TRUE(hosts->is_table_array());
+    // elements are replaced only through members that keep the summary
+    static_assert(std::is_const_v<std::remove_reference_t<decltype(hosts->get())>>);
+    static_assert(std::is_const_v<std::remove_reference_t<decltype(*hosts->begin())>>);
+    hosts->erase(hosts->begin());
+    hosts->insert(hosts->begin(), toml::make_table(true));
+    EXPECT_TRUE(hosts->has_inline_table());
+    hosts->erase(hosts->begin());
+    EXPECT_FALSE(hosts->has_inline_table());
+    EXPECT_EQ(hosts->size(), 1u);
+
+    mixed->erase(mixed->begin());
+    EXPECT_TRUE(mixed->is_table_array());
+    mixed->clear();
+    EXPECT_EQ(mixed->element_type(), base_type::None);
+    EXPECT_FALSE(mixed->has_inline_table());
+}
+
+TEST(toml_test, parse_table_array_append)
+{
+    std::string text;
+    for (int i = 0; i < 50000; ++i)
+    {
+        text += "[[hosts]]\nid = " + std::to_string(i) + "\n[hosts.meta]\nrack = " + std::to_string(i % 8) + "\n";
+    }
+    auto view = toml::parse(text).ok();
+    EXPECT_EQ(view["hosts"].as<toml::array>()->size(), 50000u);
+    EXPECT_EQ(view["hosts"][49999]["id"].as<int>(), 49999);
+    EXPECT_EQ(view["hosts"][49999]["meta.rack"].as<int>(), 7);
+
+    auto appended = toml::parse("a = [{x = 1}]\n[[a]]\nx = 2");
+    ASSERT_TRUE(appended.is_err());
+    EXPECT_EQ(appended.err().description(), "static table array `a` cannot be appended to");
+    EXPECT_TRUE(toml::parse("a = []\n[[a]]").is_err());
+    EXPECT_TRUE(toml::parse("a = [1]\n[[a]]").is_err());
+}
+
+struct decode_server
+{
+    std::string host;
+    uint16_t port = 8080;
+    std::vector<std::string> tags;
+    std::optional<double> weight;
+};
+
+TOML_BIND(decode_server,
+          toml::required("host", &decode_server::host),
+          toml::field("port", &decode_server::port),
+          toml::field("tags", &decode_server::tags),
+          toml::field("weight", &decode_server::weight))
+
+struct decode_config
+{
+    std::string title = "untitled";
+    local_date released;
+    std::vector<int64_t> ports;
+    std::vector<decode_server> servers;
+    std::map<std::string, int> limits;
+    std::unordered_map<std::string, decode_server> backups;
+    std::string owner;
+    node_view extra;
+};
+
+TOML_BIND(decode_config,
+          toml::field("title", &decode_config::title),
+          toml::field("released", &decode_config::released),
+          toml::field("ports", &decode_config::ports),
+          toml::required("servers", &decode_config::servers),
+          toml::field("limits", &decode_config::limits),
+          toml::field("backups", &decode_config::backups),
+          toml::field("owner.name", &decode_config::owner),
+          toml::field("extra", &decode_config::extra))
+
+TEST(toml_test, parse_decode)
+{
+    const auto source = R"(
+released = 2024-03-01T10:00:00
+ports = [8001, 8002]
+limits = {cpu = 4, memory = 512}
+owner = {name = "Tom"}
+extra = {anything = [1, "two"]}
+
+[[servers]]
+host = "alpha"
+tags = ["a", "b"]
+weight = 2
+
+[[servers]]
+host = "beta"
+port = 9000
+
+[backups.gamma]
+host = "gamma"
+)";
+    toml::parse_options compact;
+    compact.compact = true;
+    for (const auto &options : {toml::parse_options{}, compact})
+    {
+        auto config = toml::decode<decode_config>(toml::parse(source, options).ok());
+        EXPECT_EQ(config.title, "untitled");
+        EXPECT_EQ(config.released.day, 1);
+        EXPECT_EQ(config.ports, (std::vector<int64_t>{8001, 8002}));
+        ASSERT_EQ(config.servers.size(), 2u);
+        EXPECT_EQ(config.servers[0].host, "alpha");
+        EXPECT_EQ(config.servers[0].port, 8080);
+        EXPECT_EQ(config.servers[0].tags, (std::vector<std::string>{"a", "b"}));
+        EXPECT_EQ(config.servers[0].weight, std::optional{2.0});
+        EXPECT_EQ(config.servers[1].port, 9000);
+        EXPECT_FALSE(config.servers[1].weight);
+        EXPECT_EQ(config.limits, (std::map<std::string, int>{{"cpu", 4}, {"memory", 512}}));
+        EXPECT_EQ(config.backups.at("gamma").host, "gamma");
+        EXPECT_EQ(config.owner, "Tom");
+        EXPECT_EQ(config.extra["anything"][1].as<std::string>(), "two");
+    }
+
+    auto error_of = [](const char *text)
+    {
+        try
+        {
+            toml::decode<decode_config>(toml::parse(text).ok());
+        }
+        catch (const toml::decode_error &e)
+        {
+            return std::make_pair(e.path(), std::string{e.what()});
+        }
+        return std::make_pair(std::string{}, std::string{});
+    };
+    EXPECT_EQ(error_of("").second, "servers: missing required key");
+    EXPECT_EQ(error_of("title = 1\nservers = []").second, "title: expected a string");
+    EXPECT_EQ(error_of("[[servers]]\nhost = 'a'\n[[servers]]\nport = 1").second,
+              "servers[1].host: missing required key");
+    EXPECT_EQ(error_of("[[servers]]\nhost = 'a'\nport = 70000").second,
+              "servers[0].port: integer 70000 is out of range");
+    EXPECT_EQ(error_of("servers = [{host = 'a', tags = ['x', 1]}]").first, "servers[0].tags[1]");
+    EXPECT_EQ(error_of("servers = []\nlimits = {cpu = 'many'}").first, "limits.cpu");
+    EXPECT_EQ(error_of("servers = {}").second, "servers: expected an array");
+
+    // decoding into an existing object keeps what the document leaves out
+    decode_server server;
+    server.port = 1;
+    toml::decode(toml::parse("host = 'delta'").ok(), server);
+    EXPECT_EQ(server.host, "delta");
+    EXPECT_EQ(server.port, 1);
+}
+
+TEST(toml_test, parse_encode)
+{
+    decode_server server;
+    server.host = "alpha \"one\"";
+    server.tags = {"a", "b"};
+    auto text = toml::encode(server);
+    EXPECT_EQ(text, "host = \"alpha \\\"one\\\"\"\nport = 8080\ntags = [\"a\", \"b\"]\n\n");
+
+    // the layout is the one the tree writer gives the same document
+    std::string tree_text;
+    toml_writer{tree_text}.visit(*toml::parse(text).ok().as<toml::table>());
+    EXPECT_EQ(text, tree_text);
+
+    decode_config config;
+    config.released = {2024, 3, 1};
+    config.ports = {8001, 8002};
+    config.servers = {server, server};
+    config.servers[1].weight = 0.5;
+    config.limits = {{"cpu", 4}, {"memory", 512}};
+    config.backups["zeta"].host = "z";
+    config.backups["gamma"].host = "g";
+    config.owner = "Tom";
+    config.extra = toml::parse("anything = [1, 'two']\n[deep]\nx = 1").ok();
+
+    std::ostringstream stream;
+    toml_writer writer{stream};
+    writer.encode(config);
+    text = stream.str();
+    EXPECT_LT(text.find("[backups.gamma]"), text.find("[backups.zeta]"));
+    EXPECT_NE(text.find("owner.name = \"Tom\""), std::string::npos);
+
+    auto decoded = toml::decode<decode_config>(toml::parse(text).ok());
+    EXPECT_EQ(decoded.title, config.title);
+    EXPECT_EQ(decoded.released.month, 3);
+    EXPECT_EQ(decoded.ports, config.ports);
+    ASSERT_EQ(decoded.servers.size(), 2u);
+    EXPECT_EQ(decoded.servers[0].host, server.host);
+    EXPECT_EQ(decoded.servers[1].tags, server.tags);
+    EXPECT_EQ(decoded.servers[1].weight, std::optional{0.5});
+    EXPECT_FALSE(decoded.servers[0].weight);
+    EXPECT_EQ(decoded.limits, config.limits);
+    EXPECT_EQ(decoded.backups.size(), 2u);
+    EXPECT_EQ(decoded.backups["zeta"].host, "z");
+    EXPECT_EQ(decoded.owner, "Tom");
+    EXPECT_EQ(decoded.extra["deep.x"].as<int>(), 1);
+
+    // arrays of structs inside arrays are written as inline tables
+    std::map<std::string, std::vector<std::vector<decode_server>>> nested{{"grid", {{server}}}};
+    text = toml::encode(nested);
+    EXPECT_EQ(text, "grid = [[{host = \"alpha \\\"one\\\"\", port = 8080, tags = [\"a\", \"b\"]}]]\n\n");
+    EXPECT_EQ(toml::parse(text).ok()["grid"][0][0]["port"].as<int>(), 8080);
+}
+
+TEST(toml_test, parse_document_cache)
+{
+    auto current_dir = std::filesystem::path(__FILE__).parent_path();
+    auto dir = std::filesystem::temp_directory_path() / ("toml_parse_cache_" + std::to_string(::getpid()));
+    auto cache_dir = dir / "cache";
+    auto source = (dir / "config.toml").string();
+    std::filesystem::create_directories(dir);
+    std::filesystem::copy_file(current_dir / "../examples/example.toml", source);
+
+    auto images = [&]
+    {
+        std::vector<std::filesystem::path> found;
+        for (const auto &entry : std::filesystem::directory_iterator{cache_dir})
+            found.push_back(entry.path());
+        return found;
+    };
+    auto write = [](const toml::node_view &view)
+    {
+        std::string out;
+        toml_writer{out}.visit(*view.as<toml::table>());
+        return out;
+    };
+
+    auto first = toml::parse_file_cached(source, cache_dir).ok();
+    EXPECT_TRUE(first.is_compact());
+    EXPECT_EQ(write(first), write(parse_file(source).ok()));
+    ASSERT_EQ(images().size(), 1u);
+    auto image = images().front();
+    auto image_time = std::filesystem::last_write_time(image);
+
+    // a hit maps the image as it is
+    auto second = toml::parse_file_cached(source, cache_dir).ok();
+    EXPECT_EQ(write(second), write(first));
+    EXPECT_EQ(std::filesystem::last_write_time(image), image_time);
+    auto doc = toml::load_document(image.string());
+    ASSERT_TRUE(doc);
+    EXPECT_GE(doc->memory_usage(), std::filesystem::file_size(image));
+    EXPECT_EQ(doc->view()[toml::path{"clients[0].data[0][1]"}].as<std::string_view>(), "delta"sv);
+    EXPECT_EQ(doc->view()["owner.dob"].as<local_date>({}).year, 1979);
+    EXPECT_FALSE(toml::load_document(image.string(), toml::source_stamp{}));
+
+    // changes are picked up, even when size and modification time stay the same
+    std::ofstream{source} << "index = 1\n";
+    EXPECT_EQ(toml::parse_file_cached(source, cache_dir).ok()["index"].as<int>(), 1);
+    auto mtime = std::filesystem::last_write_time(source);
+    std::ofstream{source} << "index = 2\n";
+    std::filesystem::last_write_time(source, mtime);
+    EXPECT_EQ(toml::parse_file_cached(source, cache_dir).ok()["index"].as<int>(), 2);
+    EXPECT_EQ(images().size(), 1u);
+
+    // the image of the first run is still readable
+    EXPECT_EQ(second["database.ports"].collect<int>(), (std::vector{8001, 8001, 8002}));
+
+    // damaged images are rejected and replaced
+    auto damage = [&](size_t offset, std::string_view bytes)
+    {
+        std::fstream file{image, std::ios::binary | std::ios::in | std::ios::out};
+        file.seekp(static_cast<std::streamoff>(offset));
+        file.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    };
+    damage(8, "\x7f");
+    EXPECT_FALSE(toml::load_document(image.string()));
+    EXPECT_EQ(toml::parse_file_cached(source, cache_dir).ok()["index"].as<int>(), 2);
+    damage(64 + 8, "\x7f"); // type of the root table
+    EXPECT_FALSE(toml::load_document(image.string()));
+    EXPECT_EQ(toml::parse_file_cached(source, cache_dir).ok()["index"].as<int>(), 2);
+    std::filesystem::resize_file(image, std::filesystem::file_size(image) - 1);
+    EXPECT_FALSE(toml::load_document(image.string()));
+    EXPECT_EQ(toml::parse_file_cached(source, cache_dir).ok()["index"].as<int>(), 2);
+    EXPECT_TRUE(toml::load_document(image.string()));
+
+    std::ofstream{source} << "index = \n";
+    auto failed = toml::parse_file_cached(source, cache_dir);
+    ASSERT_TRUE(failed.is_err());
+    EXPECT_EQ(failed.err().description().substr(0, source.size() + 2), source + ": ");
+    EXPECT_EQ(failed.err().source().line, 1u);
+    EXPECT_TRUE(toml::parse_file_cached((dir / "missing.toml").string(), cache_dir).is_err());
+
+    // without a usable cache directory files are still parsed
+    std::ofstream{source} << "index = 3\n";
+    EXPECT_EQ(toml::parse_file_cached(source, source).ok()["index"].as<int>(), 3);
+
+    std::filesystem::remove_all(dir);
+}
+} // namespace